@@ -47,8 +47,38 @@ void *rgba_pixels = sqoa_read("image.sqoa", &desc, 4);
 This library provides the following functions;
 - sqoa_read    -- read and decode a SQOA/QOI file
 - sqoa_decode  -- decode the raw bytes of a SQOA/QOI image from memory
+- sqoa_decode_into -- decode a SQOA/QOI image into a buffer you provide
+- sqoa_decode_scaled -- decode a SQOA/QOI image at 1/2, 1/4 or 1/8 size
+- sqoa_decoder_create, sqoa_decoder_feed, sqoa_decoder_info,
+  sqoa_decoder_row, sqoa_decoder_finish
+               -- decode an image row by row as its bytes arrive
 - sqoa_write   -- encode and write a SQOA/QOI file
 - sqoa_encode  -- encode an rgba buffer into a SQOA/QOI image in memory
+- sqoa_encode_bound, sqoa_encode_into
+               -- encode a SQOA/QOI image into a buffer you provide
+- sqoa_encoder_create, sqoa_encoder_rows, sqoa_encoder_finish
+               -- encode an image given a few rows at a time
+- sqoa_transcode -- convert a SQOA/QOI image between SQOA and QOI, row by row
+- sqoa_validate -- check a SQOA/QOI image in memory without decoding it
+- sqoa_histogram -- count the chunks of a SQOA/QOI image by kind
+- sqoa_info    -- read the description of a SQOA/QOI image from its header
+- sqoa_read_info -- read the description of a SQOA/QOI file from its header
+- sqoa_anim_encode -- encode a sequence of frames into a SQAN animation
+- sqoa_anim_info -- read the description and frame count of a SQAN animation
+- sqoa_anim_decode -- decode any frame of a SQAN animation
+- sqoa_anim_next -- decode the next frame of a SQAN animation in place
+- sqoa_band_encode -- encode an image into independent bands of rows
+- sqoa_band_update -- re-encode only the bands of an image that changed
+- sqoa_band_decode -- decode a banded image
+- sqoa_band_index, sqoa_band_subset
+               -- find the bands of a banded image to fetch only some of them
+- sqoa_simd_level, sqoa_set_simd_level
+               -- query or force the instruction set used by the kernels
+- sqoa_batch_create, sqoa_batch_submit, sqoa_batch_wait, sqoa_batch_destroy
+               -- encode many images concurrently on a pool of threads
+- sqoa_writer_create, sqoa_writer_encode, sqoa_writer_write,
+  sqoa_writer_flush, sqoa_writer_destroy
+               -- write many SQOA/QOI files in the background
 
 See the function declaration below for the signature and more information.
 
@@ -61,6 +91,18 @@ you can define SQOA_MALLOC and SQOA_FREE before including this library.
 This library uses memset() to zero-initialize the index. To supply your own
 implementation you can define SQOA_ZEROARR before including this library.
 
+On x86-64 with GCC or Clang, the kernels that have SIMD versions pick the best
+one for the CPU at run time (SSE4.1, AVX2 or AVX-512), so the library does not
+need to be compiled with -march. Define SQOA_NO_SIMD before including this
+library to only build the portable versions.
+
+The sqoa_batch and sqoa_writer functions use POSIX threads and are only
+available if you define SQOA_THREADS before including this library. Link with
+-pthread. On Linux you can also define SQOA_IO_URING to have sqoa_writer submit
+its files to io_uring (kernel 5.15 or later, needs _DEFAULT_SOURCE or
+-std=gnu99) instead of writing them from a thread; the thread is still used
+when io_uring is not available or the kernel is older.
+
 
 -- Data Format
 
@@ -72,13 +114,28 @@ struct sqoa_header_t {
     uint32_t width;      // image width in pixels (BE)
     uint32_t height;     // image height in pixels (BE)
     uint8_t  channels;   // 1 = MONO, 2 = MONOA, 3 = RGB, 4 = RGBA, 5 = BGR, 6 = BGRA
-    uint8_t  colorspace; // 0 = sRGB with linear alpha, 1 = all channels linear
+    uint8_t  colorspace; // 0 = sRGB with linear alpha, 1 = all channels linear,
+                         // + 0x80 with extensions
     uint8_t  qoi_compat; // 0 = no compatibility, 1 = compatible with QOI
 };
 
 The value of the start byte is 49 ('1'). If the start byte is missing, the
 decoder switches to QOI compatibility mode.
 
+An image that uses experimental extensions has a start byte of 50 ('2'), 
+followed with a byte of extension flags, and bit 7 (0x80) of its colorspace
+byte set. Decoders written before the extensions take any other start byte for
+QOI compatibility mode, the colorspace bit makes them refuse the image instead.
+The extension flags are:
+
+    bit 0 (0x01):    colour index, see SQOA_OP_INDEX
+    bits 1-2 (0x06): predictor for SQOA_OP_LUMA, see Prediction below
+    bit 3 (0x08):    YCoCg-R colour transform, see Colour transform below
+    bit 4 (0x10):    checksum, see Checksum below
+    bit 5 (0x20):    references, see SQOA_OP_REF
+
+A decoder must refuse an image with extension flags it does not know.
+
 Images are encoded row by row, left to right, top to bottom. The decoder and
 encoder start with {r: 0, g: 0, b: 0, a: 255} as the previous pixel value. An
 image is complete when all pixels specified by width * height have been covered.
@@ -123,6 +180,16 @@ alpha channel update operation and cannot be used.
 The reference starts length bytes before the offset location, so the offset
 actually marks the end of the reference.
 
+The referenced bytes are decoded as if they stood in place of the SQOA_OP_REF
+chunk, after them decoding continues with the byte following it. They must
+begin with a chunk other than SQOA_OP_REF or SQOA_OP_ALPHA, but they may end in
+the middle of a chunk, which is then completed from the bytes after the
+SQOA_OP_REF chunk.
+
+Decoders written before these rules skip a byte after a reference, so an
+encoder only writes SQOA_OP_REF chunks in images with the references extension
+flag, which those decoders refuse.
+
 
 .- SQOA_OP_ALPHA ---------.
 |         Byte[0]         |
@@ -139,7 +206,10 @@ so "1 - 2" will result in 255, while "255 + 1" will result in 0.
 Values are stored as unsigned integers with a bias of 16. E.g. -16 is stored as
 0 (b00000). 1 is stored as 17 (b10001).
 
-The alpha channel update applies to last pixel.
+The alpha channel update applies to last pixel. It can follow any chunk, in
+colour as well as in grayscale (MONOA) images. Decoders written before the
+extensions only read it in colour images, so in grayscale images it is only
+written in images with extensions.
 
 
 .- SQOA_OP_LUMA ------------------------------------.
@@ -279,6 +349,126 @@ The run-length is stored with a bias of -1. Note that the run-lengths 63 and 64
 SQOA_OP_RGBA tags.
 
 
+
+-- Extensions
+
+.- SQOA_OP_INDEX ---------.
+|         Byte[0]         |
+|  7  6  5  4  3  2  1  0 |
+|-------------------------|
+|   index + 221 (0xdd)    |
+`-------------------------`
+8-bit value between b11011101 and b11111100
+index into the colour index array: 0..31
+
+Only used with the colour index extension. The encoder and decoder keep a
+zero-initialized array of 32 previously seen pixel values. Every pixel that is
+not repeated from a run is stored in the array at
+    index_position = (r * 3 + g * 5 + b * 7 + a * 11) % 32
+where r and b are 0 in grayscale images.
+
+Since SQOA_OP_INDEX takes the upper values of SQOA_OP_RUN, the run-length of
+SQOA_OP_RUN is limited to 1..29 (b000000 to b011100) with this extension.
+
+
+-- Prediction
+
+By default SQOA_OP_LUMA encodes the difference of the colour channels from the
+previous pixel. The predictor extension changes the reference to be computed
+from the pixels above (up) and above-left (upleft) of the current pixel, with
+left being the previous pixel:
+
+    1 = up
+    2 = average, (left + up) / 2 rounded down
+    3 = paeth, the one of left, up or upleft closest to left + up - upleft
+
+This applies to each of the red, green and blue channels. In the first row of
+the image the previous pixel is used, in the first column the pixel above.
+The alpha channel, SQOA_OP_ALPHA and SQOA_OP_RUN still refer to the previous
+pixel. A decoder only needs to keep one row of pixels.
+
+
+-- Colour transform
+
+With the YCoCg-R extension the three values of SQOA_OP_LUMA in colour images
+are a reversible YCoCg-R transform of the differences dr, dg, db (after
+prediction) instead of dg, dr - dg and db - dg:
+    co = dr - db
+    t  = db + (co >> 1)
+    cg = dg - t
+    y  = t + (cg >> 1)
+y is stored in the 6-bit field, co in place of dr - dg and cg in place of
+db - dg, with the same biases. All differences wrap around like the channel
+values, and the shifts are arithmetic. The decoder reverses the steps:
+    t  = y - (cg >> 1)
+    dg = cg + t
+    db = t - (co >> 1)
+    dr = db + co
+
+
+-- Checksum
+
+With the checksum extension a CRC-32C (Castagnoli) of all bytes before it, from
+the header up to and including the end marker, is stored as a 32 bit big endian
+value after the end marker. It is computed like the CRC-32C of iSCSI
+and ext4: reflected polynomial 0x82f63b78, initial value and final xor
+0xffffffff.
+
+
+-- Animation
+
+A SQAN animation stores a sequence of frames of the same size, each frame being
+a complete SQOA image. It starts with an 18 byte header and an index of the
+frames:
+
+struct sqan_header_t {
+    char     magic[4];    // magic bytes "Sqan"
+    uint32_t width;       // frame width in pixels (BE)
+    uint32_t height;      // frame height in pixels (BE)
+    uint8_t  channels;    // as in the SQOA header
+    uint8_t  colorspace;  // as in the SQOA header
+    uint32_t frame_count; // number of frames (BE)
+};
+
+struct sqan_frame_t {
+    uint32_t offset;      // position of the frame image from the start (BE)
+    uint32_t size;        // size in bytes of the frame image (BE)
+    uint8_t  keyframe;    // 1 = keyframe, 0 = delta frame
+};
+
+A keyframe image holds the pixels of the frame. A delta frame image holds, for
+every channel, the difference to the same pixel of the previous frame modulo
+256: pixels that did not change are {0, 0, 0, 0} and become runs. A channel
+missing from the frame images is not part of the difference. The first frame
+is always a keyframe, so that any frame can be decoded starting from the
+keyframe before it.
+
+
+-- Bands
+
+A banded image splits an image into bands of rows that are encoded as separate
+SQOA images, so that a band can be re-encoded and replaced without touching the
+others. It starts with an 18 byte header followed by the offset and size of
+every band:
+
+struct sqbd_header_t {
+    char     magic[4];    // magic bytes "Sqbd"
+    uint32_t width;       // image width in pixels (BE)
+    uint32_t height;      // image height in pixels (BE)
+    uint8_t  channels;    // as in the SQOA header
+    uint8_t  colorspace;  // as in the SQOA header
+    uint32_t band_height; // rows per band, the last band may have fewer (BE)
+};
+
+struct sqbd_band_t {
+    uint32_t offset;      // position of the band image from the start (BE)
+    uint32_t size;        // size in bytes of the band image (BE)
+};
+
+Each band image is width pixels wide and band_height rows high, and has its
+own extensions and checksum.
+
+
 */
 
 
@@ -297,6 +487,12 @@ It describes either the input format (for sqoa_write and sqoa_encode), or is
 filled with the description read from the file header (for sqoa_read and
 sqoa_decode).
 
+For encoding, zero the whole struct before filling in the fields you need,
+with memset or an initializer such as (sqoa_desc){.width = w, ...}: zero is
+the default of every field that follows colorspace, and the encoder refuses a
+field out of its range. A struct filled field by field without that would pass
+whatever the other fields hold.
+
 The colorspace in this sqoa_desc is an enum where
     0 = sRGB, i.e. gamma scaled RGB channels and a linear alpha channel
     1 = all channels are linear
@@ -304,7 +500,23 @@ You may use the constants SQOA_SRGB or SQOA_LINEAR. The colorspace is purely
 informative. It will be saved to the file header, but does not affect
 how chunks are en-/decoded.
 The qoi_compat field indicates if the image is in QOI format (for decode) or
-if QOI compatibility is requested (for encode). */
+if QOI compatibility is requested (for encode).
+The index_cache field enables the experimental colour index extension, see
+SQOA_OP_INDEX. The predictor field selects the pixel that SQOA_OP_LUMA
+differences are taken from, one of SQOA_PRED_LEFT (the previous pixel, as in
+QOI), SQOA_PRED_UP, SQOA_PRED_AVG or SQOA_PRED_PAETH. The transform field
+selects how the colour differences are stored in SQOA_OP_LUMA, either
+SQOA_TRANSFORM_NONE or the lossless SQOA_TRANSFORM_YCOCG_R. These extensions
+cannot be combined with qoi_compat.
+The checksum field requests a CRC-32C trailer when encoding, or tells whether
+the image has one. Only sqoa_validate verifies it.
+The effort field trades encode time for size and is only read by the encoder:
+    0 = one greedy pass, the default
+    1 = parse the chunks again to make use of SQOA_OP_REF, 5-20x slower
+    2 = also try RGB/RGBA chunks and split runs for SQOA_OP_REF, 2x slower again
+Levels 1 and 2 set the references extension flag, which decoders that predate
+it refuse. The output of any level decodes at the same speed. QOI images
+ignore it. */
 
 #define SQOA_CHAN_MONO  1
 #define SQOA_CHAN_MONOA 2
@@ -314,6 +526,15 @@ if QOI compatibility is requested (for encode). */
 #define SQOA_CHAN_BGRA  6
 #define SQOA_SRGB   0
 #define SQOA_LINEAR 1
+#define SQOA_PRED_LEFT  0
+#define SQOA_PRED_UP    1
+#define SQOA_PRED_AVG   2
+#define SQOA_PRED_PAETH 3
+#define SQOA_TRANSFORM_NONE    0
+#define SQOA_TRANSFORM_YCOCG_R 1
+#define SQOA_EFFORT_MAX 2
+
+#define SQOA_INFO_SIZE 16
 
 typedef struct {
     unsigned int width;
@@ -321,14 +542,19 @@ typedef struct {
     unsigned char channels;
     unsigned char colorspace;
     unsigned char qoi_compat;
+    unsigned char index_cache;
+    unsigned char predictor;
+    unsigned char transform;
+    unsigned char effort;
+    unsigned char checksum;
 } sqoa_desc;
 
 #ifndef SQOA_NO_STDIO
 
 /* Encode raw RGB or RGBA pixels into a SQOA image and write it to the file
-system. The sqoa_desc struct must be filled with the image width, height,
-number of channels (3 = RGB, 4 = RGBA) and the colorspace. If qoi_compat is
-non-zero, a QOI image is written instead.
+system. The sqoa_desc struct must be zeroed, then filled with the image width,
+height, number of channels (3 = RGB, 4 = RGBA) and the colorspace. If
+qoi_compat is 1, a QOI image is written instead.
 
 The function returns 0 on failure (invalid parameters, or fopen or malloc
 failed) or the number of bytes written on success. */
@@ -349,10 +575,125 @@ The returned pixel data should be free()d after use. */
 
 void *sqoa_read(const char *filename, sqoa_desc *desc, int channels);
 
+
+/* Read the description of a SQOA or QOI file from its header, without reading
+the rest of the file.
+
+The function returns 0 on failure (fopen failed, the file is too short or the
+header is invalid) or 1 on success, when the sqoa_desc struct is filled with
+the description from the file header. */
+
+int sqoa_read_info(const char *filename, sqoa_desc *desc);
+
 #endif /* SQOA_NO_STDIO */
 
+#ifdef SQOA_THREADS
+
+/* An encoding job for sqoa_batch_submit. The caller fills data and desc as
+for sqoa_encode, and may use user freely. When the job is returned by
+sqoa_batch_wait, encoded and encoded_len hold the result of sqoa_encode:
+encoded is NULL on failure and should be free()d after use otherwise.
+
+The job, its pixel data and desc must stay valid until the job is returned by
+sqoa_batch_wait. */
+
+typedef struct sqoa_job {
+    const void *data;
+    sqoa_desc desc;
+    void *user;
+    void *encoded;
+    int encoded_len;
+    struct sqoa_job *next; /* used by the batch */
+} sqoa_job;
+
+typedef struct sqoa_batch sqoa_batch;
+
+
+/* Start a batch encoder with a pool of threads. If threads is 0 or less, one
+thread is started per online processor.
+
+The function returns NULL on failure (malloc failed or no thread could be
+started) or the new batch encoder. */
+
+sqoa_batch *sqoa_batch_create(int threads);
+
+
+/* Queue a job on a batch encoder. Jobs may be submitted from any number of
+threads at once. If the queue is full, the job is encoded by the calling
+thread before returning.
+
+The function returns 0 on failure (invalid parameters) or 1 on success. */
+
+int sqoa_batch_submit(sqoa_batch *batch, sqoa_job *job);
+
 
-/* Encode raw RGB or RGBA pixels into a SQOA or QOI image in memory.
+/* Wait for a submitted job to finish. Jobs are returned in no particular
+order. Only one thread at a time may wait on a batch encoder.
+
+The function returns NULL if no submitted job is left to return, or the
+finished job. */
+
+sqoa_job *sqoa_batch_wait(sqoa_batch *batch);
+
+
+/* Finish the submitted jobs and stop the threads of a batch encoder. The
+encoded data of jobs that were not returned by sqoa_batch_wait is freed. */
+
+void sqoa_batch_destroy(sqoa_batch *batch);
+
+
+typedef struct sqoa_writer sqoa_writer;
+
+
+/* Start a background file writer. Up to depth files are written at the same
+time, a depth of 0 or less picks a default. The writer can be used from
+several threads, except when SQOA_IO_URING is defined: the io_uring backend
+has no lock, its calls must all come from one thread at a time.
+
+The function returns NULL on failure (malloc failed or no thread could be
+started) or the new writer. */
+
+sqoa_writer *sqoa_writer_create(int depth);
+
+
+/* Queue encoded SQOA or QOI data of size bytes to be written to a file. The
+writer takes ownership of the data, which is free()d once written, the
+filename is copied. The call only blocks when depth files are already being
+written.
+
+The function returns 0 on failure (invalid parameters or malloc failed, the
+data is still freed) or 1 if the file was queued. Errors writing the file are
+reported by sqoa_writer_flush. */
+
+int sqoa_writer_write(sqoa_writer *writer, const char *filename, void *data, int size);
+
+
+/* Encode raw pixels like sqoa_encode and queue the result with
+sqoa_writer_write, so that encoding the next image overlaps with the writes.
+
+The function returns 0 on failure (invalid parameters or malloc failed) or 1
+if the file was queued. */
+
+int sqoa_writer_encode(sqoa_writer *writer, const char *filename, const void *data, const sqoa_desc *desc);
+
+
+/* Wait until all the queued files are written.
+
+The function returns the number of files that could not be written since the
+last call to sqoa_writer_flush, or -1 for invalid parameters. */
+
+int sqoa_writer_flush(sqoa_writer *writer);
+
+
+/* Wait for the queued files and stop a background file writer. */
+
+void sqoa_writer_destroy(sqoa_writer *writer);
+
+#endif /* SQOA_THREADS */
+
+
+/* Encode raw RGB or RGBA pixels into a SQOA or QOI image in memory. The
+sqoa_desc struct is zeroed and filled in as for sqoa_write.
 
 The function either returns NULL on failure (invalid parameters or malloc
 failed) or a pointer to the encoded data on success. On success the out_len
@@ -363,6 +704,79 @@ The returned sqoa data should be free()d after use. */
 void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len);
 
 
+/* Return the largest size in bytes of an image encoded with this description,
+the size of the buffer sqoa_encode_into needs.
+
+The function returns 0 if the description is invalid or the size does not fit
+an int. */
+
+int sqoa_encode_bound(const sqoa_desc *desc);
+
+
+/* Encode raw pixels as for sqoa_encode, into bytes instead of a buffer it
+allocates. size is the size of bytes, at least sqoa_encode_bound(desc).
+
+The function returns 0 on failure (invalid parameters or bytes too small) or
+the size in bytes of the encoded data. */
+
+int sqoa_encode_into(const void *data, const sqoa_desc *desc, void *bytes, int size);
+
+
+/* A callback that receives the encoded bytes of a streaming encoder, in
+order. It returns 0 on failure or non-zero on success. */
+
+typedef int (*sqoa_write_func)(void *user, const void *data, int size);
+
+typedef struct sqoa_encoder sqoa_encoder;
+
+
+/* Start a streaming encoder, that is given the pixels a few rows at a time
+and passes the encoded bytes to the write callback as they are produced. Only
+one row of pixels and a small output buffer are kept. The sqoa_desc struct is
+as for sqoa_encode, except that effort must be 0: references need the whole
+chunk stream.
+
+The function either returns NULL on failure (invalid parameters or malloc
+failed) or the new encoder. */
+
+sqoa_encoder *sqoa_encoder_create(const sqoa_desc *desc, sqoa_write_func write, void *user);
+
+
+/* Encode the next row_count rows of raw pixels, in the format of the pixels of
+sqoa_encode.
+
+The function returns 0 on failure (invalid parameters, more rows than the
+image height, or the write callback failed) or 1 on success. */
+
+int sqoa_encoder_rows(sqoa_encoder *encoder, const void *rows, int row_count);
+
+
+/* Write the end of the image and free the encoder, whether it succeeded or
+not.
+
+The function returns 0 on failure (missing rows, or an earlier call failed)
+or the total number of bytes written on success. */
+
+int sqoa_encoder_finish(sqoa_encoder *encoder);
+
+
+/* Convert a SQOA or QOI image in memory into another SQOA or QOI image,
+passing the encoded bytes to the write callback as they are produced. The
+width, height, channels and colorspace are those of the source image, the
+qoi_compat, index_cache, predictor, transform and checksum fields are taken
+from the options, the other fields of the options are ignored. A MONO or MONOA
+image is converted to RGB or RGBA for QOI.
+
+Each row is decoded and encoded again before the next one: only a row of
+pixels and the output buffer of a streaming encoder are kept.
+
+The function returns 0 on failure (invalid parameters, invalid source image,
+malloc or the write callback failed) or the total number of bytes written on
+success. */
+
+int sqoa_transcode(const void *data, int size, const sqoa_desc *options, sqoa_write_func write, void *user);
+
+
 /* Decode a SQOA or QOI image from memory.
 
 The function either returns NULL on failure (invalid parameters or malloc
@@ -374,6 +788,303 @@ The returned pixel data should be free()d after use. */
 void *sqoa_decode(const void *data, int size, sqoa_desc *desc, int channels);
 
 
+/* Decode a SQOA or QOI image from memory as for sqoa_decode, into pixels
+instead of a buffer it allocates. pixels_size is the size of pixels, at least
+width * height * channels bytes, with the channels chosen as for sqoa_decode;
+sqoa_info gives the width, height and channels of the image beforehand.
+
+The function returns 0 on failure (invalid parameters or data, or pixels too
+small) or 1 on success, when the sqoa_desc struct is filled with the
+description from the file header. The pixels may have been written to even if
+the function failed. */
+
+int sqoa_decode_into(const void *data, int size, sqoa_desc *desc, int channels, void *pixels, int pixels_size);
+
+
+/* Decode a SQOA or QOI image from memory into a smaller image, scale being 1, 2,
+4 or 8. Each output pixel is the average of a scale x scale block of pixels,
+computed while decoding: the full size image is never stored.
+
+The output image is (width + scale - 1) / scale pixels wide and
+(height + scale - 1) / scale pixels high. The blocks in the last column and row
+are cut short when the image size is not a multiple of scale.
+
+The function either returns NULL on failure (invalid parameters or malloc
+failed) or a pointer to the decoded pixels. On success, the sqoa_desc struct
+is filled with the description from the file header, the width and height are
+those of the full size image.
+
+The returned pixel data should be free()d after use. */
+
+void *sqoa_decode_scaled(const void *data, int size, sqoa_desc *desc, int channels, int scale);
+
+
+typedef struct sqoa_decoder sqoa_decoder;
+
+
+/* Start an incremental decoder, that is given the encoded bytes as they
+arrive, in pieces of any size, and returns the decoded pixels one row at a
+time. None of its functions wait for more input: when the bytes given so far
+do not hold the next row, sqoa_decoder_row returns NULL and the caller feeds
+more bytes once it has them. The channels are chosen as for sqoa_decode.
+
+Only the bytes that a SQOA_OP_REF may still go back to are kept once they are
+decoded, so the memory used is about one row of pixels and the largest piece
+fed at once.
+
+The function either returns NULL on failure (invalid parameters or malloc
+failed) or the new decoder. */
+
+sqoa_decoder *sqoa_decoder_create(int channels);
+
+
+/* Give the next size bytes of the image to the decoder. The header is read as
+soon as SQOA_INFO_SIZE bytes were fed.
+
+The function returns 0 on failure (invalid parameters or header, malloc
+failed, or an earlier call failed) or 1 on success. */
+
+int sqoa_decoder_feed(sqoa_decoder *decoder, const void *data, int size);
+
+
+/* Read the description from the file header, once it was fed to the decoder.
+
+The function returns 0 if the header was not read yet or 1 when the sqoa_desc
+struct is filled with the description from the file header. */
+
+int sqoa_decoder_info(const sqoa_decoder *decoder, sqoa_desc *desc);
+
+
+/* Decode the next row of pixels from the bytes fed so far. The row is
+width * channels bytes in the format of the pixels of sqoa_decode, and stays
+valid until the next call to sqoa_decoder_row or sqoa_decoder_finish.
+
+The function returns NULL if the row needs more bytes, after the last row or on
+failure (invalid parameters or data), or a pointer to the row. */
+
+const void *sqoa_decoder_row(sqoa_decoder *decoder);
+
+
+/* Check the end of the image and free the decoder, whether it succeeded or
+not. All the rows must have been returned by sqoa_decoder_row and all the
+bytes of the image fed, with nothing after them.
+
+The function returns 0 on failure (missing rows or bytes, invalid end marker
+or checksum, or an earlier call failed) or 1 on success. */
+
+int sqoa_decoder_finish(sqoa_decoder *decoder);
+
+
+/* Read the description of a SQOA or QOI image from its header. Only the first
+SQOA_INFO_SIZE bytes of the image are needed, size may be less than the size
+of the whole image.
+
+The function returns 0 on failure (invalid parameters or header) or 1 on
+success, when the sqoa_desc struct is filled with the description from the
+file header. */
+
+int sqoa_info(const void *data, int size, sqoa_desc *desc);
+
+
+/* Check a SQOA or QOI image in memory without decoding its pixels: the header,
+that the chunks cover exactly width * height pixels, that every SQOA_OP_REF
+stays within the chunks, the end marker and, if the image has one, the
+checksum.
+
+The function returns 1 if the image is valid and 0 otherwise. The sqoa_desc
+struct is filled with the description from the file header if it could be
+read. */
+
+int sqoa_validate(const void *data, int size, sqoa_desc *desc);
+
+
+/* The kinds of chunks counted by sqoa_histogram. SQOA_HIST_INDEX counts the
+SQOA_OP_INDEX chunks of the index extension and the QOI_OP_INDEX chunks of a
+QOI image, SQOA_HIST_DIFF only the QOI_OP_DIFF chunks. */
+
+#define SQOA_HIST_RGB    0
+#define SQOA_HIST_RGBA   1
+#define SQOA_HIST_LUMA   2
+#define SQOA_HIST_RUN    3
+#define SQOA_HIST_BIGRUN 4
+#define SQOA_HIST_INDEX  5
+#define SQOA_HIST_DIFF   6
+#define SQOA_HIST_ALPHA  7
+#define SQOA_HIST_REF    8
+#define SQOA_HIST_COUNT  9
+
+
+/* Count the chunks of a SQOA or QOI image in memory by kind, walking them as
+sqoa_validate does. counts must hold SQOA_HIST_COUNT entries, they are set to
+0 first. A SQOA_OP_REF is counted as SQOA_HIST_REF and the chunk it repeats
+as its own kind, a SQOA_OP_ALPHA apart from the chunk it follows.
+
+The function returns 1 if the image is valid and 0 otherwise, the counts of
+an invalid image may be partial. The sqoa_desc struct is filled as by
+sqoa_validate. */
+
+int sqoa_histogram(const void *data, int size, sqoa_desc *desc, unsigned int *counts);
+
+
+/* Encode a sequence of frame_count frames, each of raw pixels as for
+sqoa_encode, into a SQAN animation in memory. Every key_interval-th frame is
+a keyframe, the others are delta frames. If key_interval is 0 or less, only the
+first frame is a keyframe. The sqoa_desc struct is used for every frame image.
+
+The function either returns NULL on failure (invalid parameters or malloc
+failed) or a pointer to the encoded data on success. On success the out_len
+is set to the size in bytes of the encoded data.
+
+The returned data should be free()d after use. */
+
+void *sqoa_anim_encode(const void *const *frames, int frame_count, const sqoa_desc *desc, int key_interval, int *out_len);
+
+
+/* Read the description of a SQAN animation from its header.
+
+The function returns 0 on failure (invalid parameters or header) or the number
+of frames, when the sqoa_desc struct is filled with the frame width, height,
+channels and colorspace. */
+
+int sqoa_anim_info(const void *data, int size, sqoa_desc *desc);
+
+
+/* Decode frame number frame (starting at 0) of a SQAN animation, from the
+keyframe before it. The channels are chosen as for sqoa_decode.
+
+The function either returns NULL on failure (invalid parameters or data, or
+malloc failed) or a pointer to the decoded pixels. On success, the sqoa_desc
+struct is filled as by sqoa_anim_info.
+
+The returned pixel data should be free()d after use. */
+
+void *sqoa_anim_decode(const void *data, int size, sqoa_desc *desc, int frame, int channels);
+
+
+/* Decode frame number frame of a SQAN animation into pixels, which must hold
+the previous frame decoded with the same channels unless the frame is a
+keyframe. Playing an animation this way costs one frame decode per frame.
+
+The function returns 0 on failure (invalid parameters or data, or malloc
+failed) or 1 on success. */
+
+int sqoa_anim_next(const void *data, int size, int frame, void *pixels, int channels);
+
+
+/* A rectangle of pixels, used to tell sqoa_band_update what changed. */
+
+typedef struct {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+} sqoa_rect;
+
+
+/* Encode raw pixels as for sqoa_encode into a banded image of band_height
+rows per band. The sqoa_desc struct is used for every band image.
+
+The function either returns NULL on failure (invalid parameters or malloc
+failed) or a pointer to the encoded data on success. On success the out_len
+is set to the size in bytes of the encoded data.
+
+The returned data should be free()d after use. */
+
+void *sqoa_band_encode(const void *data, const sqoa_desc *desc, int band_height, int *out_len);
+
+
+/* Update a banded image, prev, to the raw pixels in data. Only the bands that
+overlap one of the rect_count dirty rectangles are encoded again from data,
+the other bands are copied from prev. The width, height and channels in the
+sqoa_desc struct must match prev.
+
+The function either returns NULL on failure (invalid parameters or data, or
+malloc failed) or a pointer to the encoded data on success. On success the
+out_len is set to the size in bytes of the encoded data.
+
+The returned data should be free()d after use. */
+
+void *sqoa_band_update(const void *prev, int prev_size, const void *data, const sqoa_desc *desc, const sqoa_rect *rects, int rect_count, int *out_len);
+
+
+/* Decode a banded image from memory. The channels are chosen as for
+sqoa_decode.
+
+The function either returns NULL on failure (invalid parameters or data, or
+malloc failed) or a pointer to the decoded pixels. On success, the sqoa_desc
+struct is filled with the width, height, channels and colorspace of the
+image.
+
+The returned pixel data should be free()d after use. */
+
+void *sqoa_band_decode(const void *data, int size, sqoa_desc *desc, int channels);
+
+
+/* Where a band is in a banded image and which rows it holds. The band image
+is a SQOA image of its own, that sqoa_decode can decode alone. */
+
+typedef struct {
+    unsigned int offset;
+    unsigned int size;
+    unsigned int y;
+    unsigned int height;
+} sqoa_band;
+
+
+/* Read the band index of a banded image. Only its first
+SQOA_BAND_INDEX_SIZE(bands) bytes are needed, the header and the band index,
+so that a client can fetch the bands it needs with range requests: size may be
+less than the size of the whole image. With bands NULL, only the
+SQOA_BAND_INFO_SIZE bytes of the header are needed. Otherwise, bands is filled
+with the first max_bands bands, or all of them if there are fewer.
+
+The function returns 0 on failure (invalid parameters or header, or the band
+index is cut short) or the number of bands, when the sqoa_desc struct is filled
+with the width, height, channels and colorspace of the image. */
+
+#define SQOA_BAND_INFO_SIZE 18
+#define SQOA_BAND_INDEX_SIZE(bands) (SQOA_BAND_INFO_SIZE + (bands) * 8)
+
+int sqoa_band_index(const void *data, int size, sqoa_desc *desc, sqoa_band *bands, int max_bands);
+
+
+/* Write the header and band index of a banded image made of count bands of
+the banded image in data, starting at band first. The band images follow the
+written bytes in order, unchanged: they can be served from the original image
+as they are. data is as for sqoa_band_index, out must hold
+SQOA_BAND_INDEX_SIZE(count) bytes.
+
+The function returns 0 on failure (invalid parameters or header, bands outside
+the image or out too small) or the number of bytes written. */
+
+int sqoa_band_subset(const void *data, int size, int first, int count, void *out, int out_size);
+
+
+/* The instruction set levels of the SIMD kernels. Each level includes the
+ones before it. */
+
+#define SQOA_SIMD_AUTO   -1
+#define SQOA_SIMD_SCALAR  0
+#define SQOA_SIMD_SSE41   1
+#define SQOA_SIMD_AVX2    2
+#define SQOA_SIMD_AVX512  3
+
+
+/* Return the SIMD level the kernels use. It is detected from the CPU the first
+time it is needed, SQOA_SIMD_SCALAR if SIMD kernels are not built. */
+
+int sqoa_simd_level(void);
+
+
+/* Force the SIMD level of the kernels, for testing and benchmarking. The level
+is lowered to what the CPU supports; SQOA_SIMD_AUTO detects it again. This
+should not be called while other threads are encoding or decoding.
+
+The function returns the level now in use. */
+
+int sqoa_set_simd_level(int level);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -399,6 +1110,7 @@ Implementation */
 #define SQOA_OP_ALPHA  0x60 /* 011xxxxx */
 #define SQOA_OP_LUMA   0x80 /* 10xxxxxx */
 #define SQOA_OP_RUN    0xc0 /* 11xxxxxx */
+#define SQOA_OP_INDEX  0xdd /* 11011101 to 11111100, index extension only */
 #define SQOA_OP_BIGRUN 0xfd /* 11111101 */
 #define SQOA_OP_RGB    0xfe /* 11111110 */
 #define SQOA_OP_RGBA   0xff /* 11111111 */
@@ -411,11 +1123,15 @@ Implementation */
 #define SQOA_MAXRUN    512
 #define QOI_MAXRUN     62
 #define QOI_INDEX_SIZE 64
+#define SQOA_INDEX_SIZE 32
 #define QOI_RGBA_HASH(R, G, B, A) (R*3 + G*5 + B*7 + A*11)
 #ifndef QOI_COLOR_HASH
     #define QOI_COLOR_HASH(C) QOI_RGBA_HASH(C.rgba.r, C.rgba.g, C.rgba.b, C.rgba.a)
 #endif
-#define SQOA_NEXT(pos, end, saved) (pos == end ? pos = saved + 1 : pos++)
+#define SQOA_NEXT(pos, end, saved) (pos == end ? (pos = saved + 1) - 1 : pos++)
+/* The most bytes a chunk reads: SQOA_OP_RGBA and its 4 bytes, then the
+SQOA_OP_ALPHA that may follow */
+#define SQOA_CHUNK_MAX 6
 #define SQOA_MAGIC \
     (((unsigned int)'S') << 24 | ((unsigned int)'q') << 16 | \
      ((unsigned int)'o') <<  8 | ((unsigned int)'a'))
@@ -424,6 +1140,16 @@ Implementation */
      ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
 #define SQOA_HEADER_SIZE 14
 #define SQOA_START_BYTE 49
+#define SQOA_EXT_START_BYTE 50
+#define SQOA_EXT_COLORSPACE 0x80
+#define SQOA_EXT_INDEX 0x01
+#define SQOA_EXT_PRED  0x06
+#define SQOA_EXT_PRED_SHIFT 1
+#define SQOA_EXT_YCOCG 0x08
+#define SQOA_EXT_CRC   0x10
+#define SQOA_EXT_REF   0x20
+#define SQOA_EXT_KNOWN \
+    (SQOA_EXT_INDEX | SQOA_EXT_PRED | SQOA_EXT_YCOCG | SQOA_EXT_CRC | SQOA_EXT_REF)
 
 /* 2GB is the max file size that this implementation can safely handle. We guard
 against anything larger than that, assuming the worst case with 5 bytes per
@@ -453,92 +1179,929 @@ static unsigned int sqoa_read_32(const unsigned char *bytes, int *p) {
     return a << 24 | b << 16 | c << 8 | d;
 }
 
-void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
-    int max_size, max_run, p, run;
-    int qoi_compat, has_alpha, col_channels, index_size;
-    int px_len, px_end, px_pos, channels;
-    unsigned char *bytes;
-    const unsigned char *pixels;
-    sqoa_rgba_t index[QOI_INDEX_SIZE];
-    sqoa_rgba_t px, px_prev;
+static const unsigned int sqoa_crc32c_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
 
-    if (
-        data == NULL || out_len == NULL || desc == NULL ||
-        desc->width == 0 || desc->height == 0 ||
-        desc->channels < 1 || desc->channels > 6 ||
-        desc->colorspace > 1 ||
-        desc->height >= SQOA_PIXELS_MAX / desc->width
-    ) {
-        return NULL;
+static unsigned int sqoa_crc32c_bytes(unsigned int crc, const unsigned char *bytes, int len) {
+    int i;
+    for (i = 0; i < len; i++) {
+        crc = sqoa_crc32c_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
     }
+    return crc;
+}
 
-    qoi_compat = desc->qoi_compat;
-    has_alpha = (desc->channels & 1) == 0;
+/* The x86 SIMD kernels are compiled with target attributes next to the portable
+ones, the level is detected once and kept in sqoa_simd */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(SQOA_NO_SIMD)
+    #define SQOA_X86_SIMD
+    #include <immintrin.h>
+#endif
+
+/* Threads that first encode or decode at the same time may all detect the
+level and store it, so sqoa_simd is read and written atomically */
+#if defined(__GNUC__) || defined(__clang__)
+    #define SQOA_SIMD_LOAD() __atomic_load_n(&sqoa_simd, __ATOMIC_RELAXED)
+    #define SQOA_SIMD_STORE(level) __atomic_store_n(&sqoa_simd, (level), __ATOMIC_RELAXED)
+#else
+    #define SQOA_SIMD_LOAD() (sqoa_simd)
+    #define SQOA_SIMD_STORE(level) (sqoa_simd = (level))
+#endif
+
+static int sqoa_simd = SQOA_SIMD_AUTO;
+
+static int sqoa_simd_detect(void) {
+#ifdef SQOA_X86_SIMD
+    __builtin_cpu_init();
+    if (
+        __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl")
+    ) {
+        return SQOA_SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SQOA_SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SQOA_SIMD_SSE41;
+    }
+#endif
+    return SQOA_SIMD_SCALAR;
+}
+
+int sqoa_simd_level(void) {
+    int level = SQOA_SIMD_LOAD();
+    if (level == SQOA_SIMD_AUTO) {
+        level = sqoa_simd_detect();
+        SQOA_SIMD_STORE(level);
+    }
+    return level;
+}
+
+int sqoa_set_simd_level(int level) {
+    int supported = sqoa_simd_detect();
+    if (level == SQOA_SIMD_AUTO || level > supported) {
+        level = supported;
+    }
+    if (level < SQOA_SIMD_SCALAR) {
+        level = SQOA_SIMD_SCALAR;
+    }
+    SQOA_SIMD_STORE(level);
+    return level;
+}
+
+/* The CRC-32C instructions of SSE 4.2 and ARMv8 do 8 bytes at a time. On x86
+they are only used if the CPU supports them and the SIMD level was not forced
+down to scalar. */
+#if defined(SQOA_X86_SIMD)
+    #define SQOA_CRC32C_HW
+    #define SQOA_CRC32C_HW_SUPPORTED() \
+        (sqoa_simd_level() >= SQOA_SIMD_SSE41 && __builtin_cpu_supports("sse4.2"))
+    __attribute__((target("sse4.2")))
+    static unsigned int sqoa_crc32c_hw(unsigned int crc, const unsigned char *bytes, int len) {
+        unsigned long long c = crc, v;
+        int i = 0;
+        for (; i + 8 <= len; i += 8) {
+            memcpy(&v, bytes + i, 8);
+            c = __builtin_ia32_crc32di(c, v);
+        }
+        return sqoa_crc32c_bytes((unsigned int)c, bytes + i, len - i);
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+    #define SQOA_CRC32C_HW
+    #define SQOA_CRC32C_HW_SUPPORTED() 1
+    static unsigned int sqoa_crc32c_hw(unsigned int crc, const unsigned char *bytes, int len) {
+        unsigned long long v;
+        int i = 0;
+        for (; i + 8 <= len; i += 8) {
+            memcpy(&v, bytes + i, 8);
+            crc = __crc32cd(crc, v);
+        }
+        return sqoa_crc32c_bytes(crc, bytes + i, len - i);
+    }
+#endif
+
+/* Continue a CRC-32C over more bytes, start with 0xffffffff and invert the
+result at the end */
+static unsigned int sqoa_crc32c_update(unsigned int crc, const unsigned char *bytes, int len) {
+#ifdef SQOA_CRC32C_HW
+    if (SQOA_CRC32C_HW_SUPPORTED()) {
+        return sqoa_crc32c_hw(crc, bytes, len);
+    }
+#endif
+    return sqoa_crc32c_bytes(crc, bytes, len);
+}
+
+static unsigned int sqoa_crc32c(const unsigned char *bytes, int len) {
+    return ~sqoa_crc32c_update(0xffffffff, bytes, len);
+}
+
+/* Written without branches, they would be unpredictable on most images */
+static int sqoa_paeth(int left, int up, int upleft) {
+    int pa = up - upleft, pb = left - upleft, pc = pa + pb;
+    int up_or_upleft;
+    pa = pa < 0 ? -pa : pa;
+    pb = pb < 0 ? -pb : pb;
+    pc = pc < 0 ? -pc : pc;
+    up_or_upleft = pb <= pc ? up : upleft;
+    return (pa <= pb && pa <= pc) ? left : up_or_upleft;
+}
+
+static int sqoa_predict_1(int left, int up, int upleft, int predictor) {
+    switch (predictor) {
+        case SQOA_PRED_UP:    return up;
+        case SQOA_PRED_AVG:   return (left + up) >> 1;
+        case SQOA_PRED_PAETH: return sqoa_paeth(left, up, upleft);
+        default:              return left;
+    }
+}
+
+/* The predictor is only applied to the colour channels, alpha differences are
+always taken from the previous pixel. */
+static sqoa_rgba_t sqoa_predict(sqoa_rgba_t left, sqoa_rgba_t up, sqoa_rgba_t upleft, int predictor) {
+    sqoa_rgba_t pred = left;
+    switch (predictor) {
+        case SQOA_PRED_UP:
+            pred.rgba.r = up.rgba.r;
+            pred.rgba.g = up.rgba.g;
+            pred.rgba.b = up.rgba.b;
+            break;
+        case SQOA_PRED_AVG:
+            pred.rgba.r = (left.rgba.r + up.rgba.r) >> 1;
+            pred.rgba.g = (left.rgba.g + up.rgba.g) >> 1;
+            pred.rgba.b = (left.rgba.b + up.rgba.b) >> 1;
+            break;
+        case SQOA_PRED_PAETH:
+            pred.rgba.r = sqoa_paeth(left.rgba.r, up.rgba.r, upleft.rgba.r);
+            pred.rgba.g = sqoa_paeth(left.rgba.g, up.rgba.g, upleft.rgba.g);
+            pred.rgba.b = sqoa_paeth(left.rgba.b, up.rgba.b, upleft.rgba.b);
+            break;
+    }
+    return pred;
+}
+
+/* The state of the greedy encoder, kept between calls when the pixels are
+given a few rows at a time */
+typedef struct {
+    sqoa_desc desc;
+    int channels, col_channels, has_alpha, stride;
+    int qoi_compat, index_cache, predictor, transform, max_run, max_op_run;
+    int extended;
+    int run;
+    sqoa_rgba_t px_prev;
+    sqoa_rgba_t index[QOI_INDEX_SIZE];
+} sqoa_enc_t;
+
+/* Check the description and set up the encoder state. Returns 0 if the
+description is invalid */
+static int sqoa_encode_init(sqoa_enc_t *enc, const sqoa_desc *desc) {
+    if (
+        desc->width == 0 || desc->height == 0 ||
+        desc->channels < 1 || desc->channels > 6 ||
+        desc->colorspace > 1 ||
+        desc->height >= SQOA_PIXELS_MAX / desc->width
+    ) {
+        return 0;
+    }
+
+    enc->desc = *desc;
+    enc->qoi_compat = desc->qoi_compat;
+    enc->index_cache = desc->index_cache;
+    enc->predictor = desc->predictor;
+    enc->transform = desc->transform;
+    if (
+        enc->qoi_compat > 1 || enc->index_cache > 1 || desc->checksum > 1 ||
+        enc->predictor > SQOA_PRED_PAETH || enc->transform > SQOA_TRANSFORM_YCOCG_R ||
+        desc->effort > SQOA_EFFORT_MAX ||
+        (enc->qoi_compat && (enc->index_cache || enc->predictor || enc->transform || desc->checksum))
+    ) {
+        return 0;
+    }
+
+    enc->extended = !enc->qoi_compat && (
+        enc->index_cache || enc->predictor || enc->transform ||
+        desc->checksum || desc->effort
+    );
+
+    enc->has_alpha = (desc->channels & 1) == 0;
     if (desc->channels < 3) {
-        if (qoi_compat) {
-            return NULL;
+        if (enc->qoi_compat) {
+            return 0;
         }
-        col_channels = 1;
+        enc->col_channels = 1;
     }
     else {
-        col_channels = 3;
+        enc->col_channels = 3;
     }
-    channels = col_channels + has_alpha;
-    max_size =
-        desc->width * desc->height * (channels + 1) +
-        SQOA_HEADER_SIZE + sizeof(sqoa_padding);
+    enc->channels = enc->col_channels + enc->has_alpha;
+    enc->stride = desc->width * enc->channels;
 
-    p = 0;
-    bytes = (unsigned char *) SQOA_MALLOC(max_size);
-    if (!bytes) {
-        return NULL;
+    enc->max_op_run = 61;
+    if (enc->qoi_compat) {
+        enc->max_run = QOI_MAXRUN;
+    }
+    else {
+        enc->max_run = SQOA_MAXRUN;
+        if (enc->index_cache) {
+            enc->max_op_run = SQOA_OP_INDEX - SQOA_OP_RUN;
+        }
     }
 
-    if (qoi_compat) {
+    enc->run = 0;
+    enc->px_prev.rgba.r = 0;
+    enc->px_prev.rgba.g = 0;
+    enc->px_prev.rgba.b = 0;
+    enc->px_prev.rgba.a = 255;
+    SQOA_ZEROARR(enc->index);
+    return 1;
+}
+
+/* Write the header, start byte and extension flags. Returns the position of
+the first chunk */
+static int sqoa_encode_header(const sqoa_enc_t *enc, unsigned char *bytes) {
+    int p = 0;
+
+    if (enc->qoi_compat) {
         sqoa_write_32(bytes, &p, QOI_MAGIC);
     }
     else {
         sqoa_write_32(bytes, &p, SQOA_MAGIC);
     }
-    sqoa_write_32(bytes, &p, desc->width);
-    sqoa_write_32(bytes, &p, desc->height);
-    bytes[p++] = channels;
-    bytes[p++] = desc->colorspace;
-    
-    if (qoi_compat) {
-        max_run = QOI_MAXRUN;
+    sqoa_write_32(bytes, &p, enc->desc.width);
+    sqoa_write_32(bytes, &p, enc->desc.height);
+    bytes[p++] = enc->channels;
+
+    if (enc->qoi_compat) {
+        bytes[p++] = enc->desc.colorspace;
     }
     else {
-        max_run = SQOA_MAXRUN;
-        bytes[p++] = SQOA_START_BYTE;
+        if (enc->extended) {
+            bytes[p++] = enc->desc.colorspace | SQOA_EXT_COLORSPACE;
+            bytes[p++] = SQOA_EXT_START_BYTE;
+            bytes[p++] =
+                (enc->index_cache ? SQOA_EXT_INDEX : 0) |
+                enc->predictor << SQOA_EXT_PRED_SHIFT |
+                (enc->transform ? SQOA_EXT_YCOCG : 0) |
+                (enc->desc.checksum ? SQOA_EXT_CRC : 0) |
+                (enc->desc.effort ? SQOA_EXT_REF : 0);
+        }
+        else {
+            bytes[p++] = enc->desc.colorspace;
+            bytes[p++] = SQOA_START_BYTE;
+        }
     }
+    return p;
+}
 
-    pixels = (const unsigned char *)data;
+/* The run left at the end of the image: the decoder stops at the last pixel,
+so a big run covers it whatever its length */
+static int sqoa_encode_end(sqoa_enc_t *enc, unsigned char *bytes, int p) {
+    if (enc->run > 0) {
+        bytes[p++] = SQOA_OP_BIGRUN;
+        enc->run = 0;
+    }
+    return p;
+}
 
-    SQOA_ZEROARR(index);
+/* Grayscale images have no colour deltas to compute: work on the bytes directly
+and skip over runs 8 bytes at a time. In images with extensions a change of
+alpha is sent as a LUMA and an ALPHA chunk when it is small enough, like for
+colour images, otherwise as an RGBA chunk. */
+static int sqoa_encode_mono(
+    sqoa_enc_t *enc, const unsigned char *pixels, const unsigned char *above,
+    int px_len, unsigned char *bytes, int p
+) {
+    int has_alpha = enc->has_alpha, extended = enc->extended;
+    int index_cache = enc->index_cache, predictor = enc->predictor;
+    int channels = enc->channels, stride = enc->stride;
+    int px_pos, run = enc->run, row_start = 0;
+    int max_op_run = enc->max_op_run;
+    unsigned char pattern_bytes[8];
+    unsigned long long pattern = 0, next;
+    int prev_g = enc->px_prev.rgba.g, prev_a = enc->px_prev.rgba.a;
+    sqoa_rgba_t *index = enc->index;
+
+    /* A run can go on from the previous rows */
+    for (int i = 0; i < 8; i += channels) {
+        pattern_bytes[i] = prev_g;
+        if (has_alpha) {
+            pattern_bytes[i + 1] = prev_a;
+        }
+    }
+    memcpy(&pattern, pattern_bytes, 8);
 
-    run = 0;
-    px.rgba.r = 0;
-    px.rgba.g = 0;
-    px.rgba.b = 0;
-    px.rgba.a = 255;
-    px_prev = px;
+    for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+        int g = pixels[px_pos];
+        int a = has_alpha ? pixels[px_pos + 1] : 255;
+
+        if (g == prev_g && a == prev_a) {
+            if (run == 0) {
+                for (int i = 0; i < 8; i += channels) {
+                    pattern_bytes[i] = g;
+                    if (has_alpha) {
+                        pattern_bytes[i + 1] = a;
+                    }
+                }
+                memcpy(&pattern, pattern_bytes, 8);
+            }
+            run++;
+            while (px_pos + channels + 8 <= px_len) {
+                memcpy(&next, pixels + px_pos + channels, 8);
+                if (next != pattern) {
+                    break;
+                }
+                run += 8 / channels;
+                px_pos += 8;
+            }
+        }
+        else {
+            int pred_g = prev_g;
+            signed char vg, va = a - prev_a;
 
-    px_len = desc->width * desc->height * channels;
-    px_end = px_len - channels;
+            if (predictor) {
+                while (px_pos >= row_start + stride) {
+                    row_start += stride;
+                }
+                if (row_start > 0 || above) {
+                    const unsigned char *up = row_start > 0
+                        ? pixels + px_pos - stride
+                        : above + px_pos;
+                    if (px_pos == row_start) {
+                        pred_g = up[0];
+                    }
+                    else {
+                        pred_g = sqoa_predict_1(prev_g, up[0], up[0 - channels], predictor);
+                    }
+                }
+            }
+            vg = g - pred_g;
 
-    for (px_pos = 0; px_pos < px_len; px_pos += channels) {
-        if (col_channels == 3) {
-            px.rgba.r = pixels[px_pos + 0];
-            px.rgba.g = pixels[px_pos + 1];
-            px.rgba.b = pixels[px_pos + 2];
+            if (run > 0) {
+                while (run >= SQOA_MAXRUN) {
+                    bytes[p++] = SQOA_OP_BIGRUN;
+                    run -= SQOA_MAXRUN;
+                }
+                while (run > max_op_run) {
+                    bytes[p++] = SQOA_OP_RUN | (max_op_run - 1);
+                    run = run - max_op_run;
+                }
+                if (run > 0) {
+                    bytes[p++] = SQOA_OP_RUN | (run - 1);
+                }
+                run = 0;
+            }
+
+            if (index_cache) {
+                int index_pos = QOI_RGBA_HASH(0, g, 0, a) % SQOA_INDEX_SIZE;
+                if (index[index_pos].rgba.g == g && index[index_pos].rgba.a == a) {
+                    bytes[p++] = SQOA_OP_INDEX + index_pos;
+                    prev_g = g;
+                    prev_a = a;
+                    continue;
+                }
+                index[index_pos].rgba.g = g;
+                index[index_pos].rgba.a = a;
+            }
+
+            if (
+                vg > -33 && vg < 32 &&
+                (va == 0 || (extended && va > -17 && va < 16))
+            ) {
+                bytes[p++] = SQOA_OP_LUMA | (vg + 32);
+                if (va != 0) {
+                    bytes[p++] = SQOA_OP_ALPHA | (va + 16);
+                }
+            }
+            else {
+                bytes[p++] = SQOA_OP_RGB | (va != 0);
+                bytes[p++] = g;
+                if (va != 0) {
+                    bytes[p++] = a;
+                }
+            }
+            prev_g = g;
+            prev_a = a;
+        }
+    }
+
+    /* Whole big runs come first when the run ends, so they can be written
+now to bound the output of a call */
+    while (run >= SQOA_MAXRUN) {
+        bytes[p++] = SQOA_OP_BIGRUN;
+        run -= SQOA_MAXRUN;
+    }
+    enc->run = run;
+    enc->px_prev.rgba.g = prev_g;
+    enc->px_prev.rgba.a = prev_a;
+    return p;
+}
+
+/* Higher effort levels rewrite the greedy chunk stream with SQOA_OP_REF
+chunks. The stream is cut into units, a chunk with its trailing ALPHA chunk,
+and a block of units is parsed optimally: every unit boundary keeps the
+cheapest way found to reach it together with the bytes it ends on, since
+references point into the bytes actually written. At effort 2 a pixel can also
+be referenced as an RGB or RGBA chunk, and a run can be split so that its last
+part starts a reference. */
+#define SQOA_PARSE_BLOCK 4096
+#define SQOA_PARSE_TAIL  40
+
+typedef struct {
+    int cost, from;
+    unsigned char out_len, tail_len;
+    unsigned char out[8];
+    unsigned char tail[SQOA_PARSE_TAIL];
+} sqoa_parse_node;
+
+typedef struct {
+    const unsigned char *v, *pixels;
+    int channels, col_channels, has_alpha, max_op_run;
+    int units;
+    int unit_pos[SQOA_PARSE_BLOCK + 1];
+    int unit_px[SQOA_PARSE_BLOCK];
+} sqoa_parse_t;
+
+static int sqoa_unit_len(const unsigned char *v, int pos, int end, int col_channels) {
+    int b1 = v[pos], len = 1;
+    if (b1 == SQOA_OP_RGB) {
+        len += col_channels;
+    }
+    else if (b1 == SQOA_OP_RGBA) {
+        len += col_channels + 1;
+    }
+    else if ((b1 & SQOA_MASK_2) == SQOA_OP_LUMA && col_channels == 3) {
+        len++;
+    }
+    if (pos + len < end && v[pos + len] >= SQOA_OP_ALPHA && v[pos + len] < SQOA_OP_LUMA) {
+        len++;
+    }
+    return len;
+}
+
+static void sqoa_parse_relax(
+    sqoa_parse_node *nodes, int from, int to,
+    const unsigned char *out, int out_len
+) {
+    sqoa_parse_node *dst = nodes + to;
+    int cost = nodes[from].cost + out_len;
+    if (cost < dst->cost) {
+        dst->cost = cost;
+        dst->from = from;
+        dst->out_len = out_len;
+        memcpy(dst->out, out, out_len);
+    }
+}
+
+/* Once all ways to reach node j are known, the bytes it ends on follow from
+the node it is reached from */
+static void sqoa_parse_tail(sqoa_parse_node *nodes, int j) {
+    sqoa_parse_node *src = nodes + nodes[j].from, *dst = nodes + j;
+    int out_len = dst->out_len, keep;
+
+    keep = src->tail_len + out_len > SQOA_PARSE_TAIL ?
+        SQOA_PARSE_TAIL - out_len : src->tail_len;
+    memcpy(dst->tail, src->tail + src->tail_len - keep, keep);
+    memcpy(dst->tail + keep, dst->out, out_len);
+    dst->tail_len = keep + out_len;
+}
+
+/* Try references from node j to seq, which is unit j written as its first
+lit_len bytes followed by the units after it. pre is a chunk written before
+the reference, or -1. */
+static void sqoa_parse_refs(
+    const sqoa_parse_t *ps, sqoa_parse_node *nodes, int j, int pre,
+    const unsigned char *seq, int seq_len, int lit_len
+) {
+    unsigned char win[SQOA_PARSE_TAIL + 1], out[8];
+    const unsigned char *w = nodes[j].tail;
+    int wlen = nodes[j].tail_len, s, L;
+
+    if (seq_len < 2) {
+        return;
+    }
+    if (pre >= 0) {
+        memcpy(win, w, wlen);
+        win[wlen++] = pre;
+        w = win;
+    }
+
+    /* The reference ends at most 31 bytes before the SQOA_OP_REF chunk */
+    for (s = wlen - 34 < 0 ? 0 : wlen - 34; s < wlen - 1; s++) {
+        int m = 2;
+        if (w[s] != seq[0] || w[s + 1] != seq[1]) {
+            continue;
+        }
+        while (m < 4 && m < seq_len && s + m < wlen && w[s + m] == seq[m]) {
+            m++;
+        }
+        for (L = 2; L <= m; L++) {
+            int e = s + L, end = lit_len, to = j + 1, o = 0;
+            if (e < wlen - 30) {
+                continue;
+            }
+            while (end < L) {
+                end += ps->unit_pos[to + 1] - ps->unit_pos[to];
+                to++;
+            }
+            if (pre >= 0) {
+                out[o++] = pre;
+            }
+            out[o++] = SQOA_OP_REF | (L - 2) << 5 | (wlen + 1 - e);
+            for (e = L; e < end; e++) {
+                out[o++] = seq[e];
+            }
+            sqoa_parse_relax(nodes, j, to, out, o);
+        }
+    }
+}
+
+/* Append the bytes after unit j to the lit_len bytes in seq, as many as a
+reference of up to 4 bytes can need to complete its last unit */
+static int sqoa_parse_seq(const sqoa_parse_t *ps, int j, unsigned char *seq, int lit_len) {
+    int pos = ps->unit_pos[j + 1], end = ps->unit_pos[ps->units];
+    while (lit_len < 8 && pos < end) {
+        seq[lit_len++] = ps->v[pos++];
+    }
+    return lit_len;
+}
+
+/* Parse the units of a block into nodes[0..units], starting from the tail in
+nodes[0]. Returns the cost of the whole block. */
+static int sqoa_parse_block(const sqoa_parse_t *ps, sqoa_parse_node *nodes, int effort) {
+    const unsigned char *v = ps->v;
+    int n = ps->units, block_end = ps->unit_pos[n], j, k;
+
+    nodes[0].cost = 0;
+    for (j = 1; j <= n; j++) {
+        nodes[j].cost = 0x7fffffff;
+    }
+
+    for (j = 0; j < n; j++) {
+        const unsigned char *unit = v + ps->unit_pos[j];
+        int unit_len = ps->unit_pos[j + 1] - ps->unit_pos[j], b1 = unit[0];
+        unsigned char seq[12];
+        int seq_len;
+
+        if (j > 0) {
+            sqoa_parse_tail(nodes, j);
+        }
+        sqoa_parse_relax(nodes, j, j + 1, unit, unit_len);
+        sqoa_parse_refs(ps, nodes, j, -1, unit, block_end - ps->unit_pos[j], unit_len);
+        if (effort < 2) {
+            continue;
+        }
+
+        if (b1 >= SQOA_OP_RGB || (b1 & SQOA_MASK_2) == SQOA_OP_LUMA) {
+            /* The same pixel as an RGB or RGBA chunk */
+            const unsigned char *px = ps->pixels + ps->unit_px[j] * ps->channels;
+            int col_channels = ps->col_channels, va = 0, lit_len;
+            if (ps->has_alpha) {
+                int prev_a = ps->unit_px[j] > 0 ? px[col_channels - ps->channels] : 255;
+                va = (signed char)(px[col_channels] - prev_a);
+            }
+            for (k = 0; k < col_channels; k++) {
+                seq[k + 1] = px[k];
+            }
+            if (va > -17 && va < 16) {
+                seq[0] = SQOA_OP_RGB;
+                lit_len = 1 + col_channels;
+                if (va != 0) {
+                    seq[lit_len++] = SQOA_OP_ALPHA | (va + 16);
+                }
+                if (lit_len != unit_len || memcmp(seq, unit, lit_len)) {
+                    seq_len = sqoa_parse_seq(ps, j, seq, lit_len);
+                    sqoa_parse_refs(ps, nodes, j, -1, seq, seq_len, lit_len);
+                }
+            }
+            if (va != 0) {
+                seq[0] = SQOA_OP_RGBA;
+                seq[1 + col_channels] = px[col_channels];
+                lit_len = 2 + col_channels;
+                if (lit_len != unit_len || memcmp(seq, unit, lit_len)) {
+                    seq_len = sqoa_parse_seq(ps, j, seq, lit_len);
+                    sqoa_parse_refs(ps, nodes, j, -1, seq, seq_len, lit_len);
+                }
+            }
+        }
+        else if (unit_len == 1 && b1 > SQOA_OP_RUN && b1 < SQOA_OP_RUN + ps->max_op_run) {
+            /* Split the run when the tail holds a shorter one to refer to */
+            unsigned long long seen = 0;
+            int run = (b1 & 0x3f) + 1;
+            for (k = 0; k < nodes[j].tail_len; k++) {
+                int t = nodes[j].tail[k];
+                if (t >= SQOA_OP_RUN && t < b1) {
+                    seen |= 1ull << (t & 0x3f);
+                }
+            }
+            for (k = 0; seen; k++, seen >>= 1) {
+                if (seen & 1) {
+                    seq[0] = SQOA_OP_RUN | k;
+                    seq_len = sqoa_parse_seq(ps, j, seq, 1);
+                    sqoa_parse_refs(ps, nodes, j, SQOA_OP_RUN | (run - k - 2), seq, seq_len, 1);
+                }
+            }
+        }
+    }
+    sqoa_parse_tail(nodes, n);
+    return nodes[n].cost;
+}
+
+static int sqoa_encode_refs(
+    unsigned char *bytes, int start, int end, const unsigned char *pixels,
+    const sqoa_desc *desc
+) {
+    int path[SQOA_PARSE_BLOCK];
+    int vp = 0, px_index = 0, p = start, v_len = end - start, j, k;
+    unsigned char *v;
+    sqoa_parse_t *ps;
+    sqoa_parse_node *nodes, *nodes_alt;
+
+    v = (unsigned char *) SQOA_MALLOC(v_len);
+    ps = (sqoa_parse_t *) SQOA_MALLOC(
+        sizeof(sqoa_parse_t) + 2 * (SQOA_PARSE_BLOCK + 1) * sizeof(sqoa_parse_node)
+    );
+    if (!v || !ps) {
+        if (v) {
+            SQOA_FREE(v);
+        }
+        if (ps) {
+            SQOA_FREE(ps);
+        }
+        return end;
+    }
+    memcpy(v, bytes + start, v_len);
+    nodes = (sqoa_parse_node *)(ps + 1);
+    nodes_alt = nodes + SQOA_PARSE_BLOCK + 1;
+
+    ps->v = v;
+    ps->pixels = pixels;
+    ps->has_alpha = (desc->channels & 1) == 0;
+    ps->col_channels = desc->channels < 3 ? 1 : 3;
+    ps->channels = ps->col_channels + ps->has_alpha;
+    ps->max_op_run = desc->index_cache ? SQOA_OP_INDEX - SQOA_OP_RUN : 61;
+
+    nodes[0].tail_len = 0;
+    while (vp < v_len) {
+        sqoa_parse_node *best = nodes;
+        int n = 0;
+
+        while (n < SQOA_PARSE_BLOCK && vp < v_len) {
+            int b1 = v[vp];
+            ps->unit_pos[n] = vp;
+            ps->unit_px[n++] = px_index;
+            vp += sqoa_unit_len(v, vp, v_len, ps->col_channels);
+            if (b1 == SQOA_OP_BIGRUN) {
+                px_index += SQOA_MAXRUN;
+            }
+            else if (b1 >= SQOA_OP_RUN && b1 < SQOA_OP_RUN + ps->max_op_run) {
+                px_index += (b1 & 0x3f) + 1;
+            }
+            else {
+                px_index++;
+            }
+        }
+        ps->unit_pos[n] = vp;
+        ps->units = n;
+
+        /* The extra choices of effort 2 can lead to a worse tail later on, so
+        the block is parsed both ways */
+        if (desc->effort >= 2) {
+            nodes_alt[0].tail_len = nodes[0].tail_len;
+            memcpy(nodes_alt[0].tail, nodes[0].tail, nodes[0].tail_len);
+            if (sqoa_parse_block(ps, nodes_alt, 2) < sqoa_parse_block(ps, nodes, 1)) {
+                best = nodes_alt;
+            }
         }
         else {
-            px.rgba.g = pixels[px_pos];
+            sqoa_parse_block(ps, nodes, 1);
+        }
+
+        /* Write out the cheapest path, found backwards from the last node,
+        and carry its bytes over to the next block */
+        for (j = n, k = 0; j > 0; j = best[j].from) {
+            path[k++] = j;
+        }
+        while (k > 0) {
+            sqoa_parse_node *node = best + path[--k];
+            memcpy(bytes + p, node->out, node->out_len);
+            p += node->out_len;
+        }
+        nodes[0].tail_len = best[n].tail_len;
+        memcpy(nodes[0].tail, best[n].tail, best[n].tail_len);
+    }
+    SQOA_FREE(v);
+    SQOA_FREE(ps);
+    return p;
+}
+
+/* Everything that follows the chunks: references at higher effort levels, the
+end marker and the checksum */
+static int sqoa_encode_finish(
+    unsigned char *bytes, int chunks_start, int p, const unsigned char *pixels,
+    const sqoa_desc *desc
+) {
+    if (desc->effort && !desc->qoi_compat) {
+        p = sqoa_encode_refs(bytes, chunks_start, p, pixels, desc);
+    }
+    for (int i = 0; i < (int)sizeof(sqoa_padding); i++) {
+        bytes[p++] = sqoa_padding[i];
+    }
+    if (desc->checksum) {
+        sqoa_write_32(bytes, &p, sqoa_crc32c(bytes, p));
+    }
+    return p;
+}
+
+#ifdef SQOA_X86_SIMD
+/* Classify the next 8 pixels of a colour image against the pixels before
+them, for the plain SQOA encoder: the bits of same are set for the pixels
+equal to the one before, the bits of luma for those that fit a SQOA_OP_LUMA
+chunk without an alpha change, whose 2 bytes are stored in codes. The pixels
+are read as RGBA, RGB pixels with an alpha of 255. pixels must have room for
+10 pixels. */
+__attribute__((target("sse4.1")))
+static void sqoa_classify_color(
+    const unsigned char *pixels, sqoa_rgba_t px_prev, int channels,
+    int *same, int *luma, unsigned char *codes
+) {
+    const __m128i g = _mm_setr_epi8(1, 1, 1, 1, 5, 5, 5, 5, 9, 9, 9, 9, 13, 13, 13, 13);
+    const __m128i range = _mm_set1_epi32(0x00f0c0f0);
+    const __m128i green = _mm_set1_epi32(0x0000ff00);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    __m128i cur[2], prev[2], eq[2], ok[2], code[2];
+    int i;
+
+    if (channels == 4) {
+        cur[0] = _mm_loadu_si128((const __m128i *)pixels);
+        cur[1] = _mm_loadu_si128((const __m128i *)(pixels + 16));
+    }
+    else {
+        const __m128i rgb = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        cur[0] = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)pixels), rgb), alpha);
+        cur[1] = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pixels + 12)), rgb), alpha);
+    }
+    prev[0] = _mm_alignr_epi8(cur[0], _mm_set1_epi32((int)px_prev.v), 12);
+    prev[1] = _mm_alignr_epi8(cur[1], cur[0], 12);
+
+    for (i = 0; i < 2; i++) {
+        /* d holds vr, vg, vb, va and q vg_r + 8, 8, vg_b + 8 per pixel. A
+        pixel fits when vg_r + 8 and vg_b + 8 fit 4 bits, vg + 32 6 bits and
+        va is 0 */
+        __m128i d = _mm_sub_epi8(cur[i], prev[i]);
+        __m128i q = _mm_add_epi8(_mm_sub_epi8(d, _mm_shuffle_epi8(d, g)), _mm_set1_epi8(8));
+        __m128i t;
+        eq[i] = _mm_cmpeq_epi32(cur[i], prev[i]);
+        t = _mm_or_si128(
+            _mm_and_si128(_mm_blendv_epi8(q, _mm_add_epi8(d, _mm_set1_epi8(32)), green), range),
+            _mm_and_si128(d, alpha)
+        );
+        ok[i] = _mm_andnot_si128(eq[i], _mm_cmpeq_epi32(t, _mm_setzero_si128()));
+
+        /* 0x80 | (vg + 32), then (vg_r + 8) << 4 | (vg_b + 8) */
+        code[i] = _mm_or_si128(
+            _mm_and_si128(_mm_srli_epi32(_mm_add_epi8(d, _mm_set1_epi8((char)0xa0)), 8), _mm_set1_epi32(0xff)),
+            _mm_slli_epi32(
+                _mm_or_si128(
+                    _mm_and_si128(_mm_slli_epi32(q, 4), _mm_set1_epi32(0xf0)),
+                    _mm_and_si128(_mm_srli_epi32(q, 16), _mm_set1_epi32(0x0f))
+                ),
+                8
+            )
+        );
+    }
+
+    *same = _mm_movemask_ps(_mm_castsi128_ps(eq[0])) | _mm_movemask_ps(_mm_castsi128_ps(eq[1])) << 4;
+    *luma = _mm_movemask_ps(_mm_castsi128_ps(ok[0])) | _mm_movemask_ps(_mm_castsi128_ps(ok[1])) << 4;
+    _mm_storeu_si128((__m128i *)codes, _mm_packus_epi32(code[0], code[1]));
+}
+#endif
+
+/* Encode px_len bytes of pixels, a whole number of rows, with the greedy
+encoder. The row above the first one is above, or NULL for the first row of the
+image. Returns the new position in bytes */
+static int sqoa_encode_color(
+    sqoa_enc_t *enc, const unsigned char *pixels, const unsigned char *above,
+    int px_len, unsigned char *bytes, int p
+) {
+    int qoi_compat = enc->qoi_compat, index_cache = enc->index_cache;
+    int predictor = enc->predictor, transform = enc->transform;
+    int has_alpha = enc->has_alpha, channels = enc->channels, stride = enc->stride;
+    int max_run = enc->max_run, max_op_run = enc->max_op_run;
+    int px_pos, run = enc->run, row_start = 0;
+    sqoa_rgba_t *index = enc->index;
+    sqoa_rgba_t px = enc->px_prev, px_prev = enc->px_prev;
+#ifdef SQOA_X86_SIMD
+    /* Without the extensions, runs and LUMA chunks are found 8 pixels at a
+    time. After a block where the first pixel needs another chunk, the next
+    pixels are left to the scalar code, twice as many each time up to 64 */
+    int block_fast =
+        sqoa_simd_level() >= SQOA_SIMD_SSE41 &&
+        !qoi_compat && !index_cache && !predictor && !transform;
+    int block_pos = 0, block_skip = 8;
+#endif
+
+    for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+#ifdef SQOA_X86_SIMD
+        if (block_fast && px_pos >= block_pos && px_pos + 10 * channels <= px_len) {
+            unsigned char codes[16];
+            int same, luma, i;
+
+            sqoa_classify_color(pixels + px_pos, px_prev, channels, &same, &luma, codes);
+            for (i = 0; i < 8; i++) {
+                if (same & (1 << i)) {
+                    run++;
+                    if (run == max_run) {
+                        bytes[p++] = SQOA_OP_BIGRUN;
+                        run = 0;
+                    }
+                }
+                else if (luma & (1 << i)) {
+                    if (run > 0) {
+                        while (run > max_op_run) {
+                            bytes[p++] = SQOA_OP_RUN | (max_op_run - 1);
+                            run = run - max_op_run;
+                        }
+                        bytes[p++] = SQOA_OP_RUN | (run - 1);
+                        run = 0;
+                    }
+                    bytes[p++] = codes[i * 2];
+                    bytes[p++] = codes[i * 2 + 1];
+                }
+                else {
+                    break;
+                }
+            }
+
+            if (i == 0) {
+                block_pos = px_pos + block_skip * channels;
+                if (block_skip < 64) {
+                    block_skip *= 2;
+                }
+            }
+            else {
+                block_skip = 8;
+                /* The alpha of these pixels does not change */
+                px_pos += i * channels;
+                px_prev.rgba.r = pixels[px_pos - channels + 0];
+                px_prev.rgba.g = pixels[px_pos - channels + 1];
+                px_prev.rgba.b = pixels[px_pos - channels + 2];
+                px = px_prev;
+                if (i == 8) {
+                    px_pos -= channels;
+                    continue;
+                }
+            }
         }
+#endif
+        px.rgba.r = pixels[px_pos + 0];
+        px.rgba.g = pixels[px_pos + 1];
+        px.rgba.b = pixels[px_pos + 2];
 
         if (has_alpha) {
-            px.rgba.a = pixels[px_pos + col_channels];
+            px.rgba.a = pixels[px_pos + 3];
         }
 
         if (px.v == px_prev.v) {
@@ -549,12 +2112,12 @@ void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
             }
         }
         else {
-            int index_pos, qoi_found;
+            int index_pos, found = 0;
             
             if (run > 0) {
-                while (run > 61) {
-                    bytes[p++] = SQOA_OP_RUN | 60;
-                    run = run - 61;
+                while (run > max_op_run) {
+                    bytes[p++] = SQOA_OP_RUN | (max_op_run - 1);
+                    run = run - max_op_run;
                 }
                 bytes[p++] = SQOA_OP_RUN | (run - 1);
                 run = 0;
@@ -563,8 +2126,8 @@ void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
             if (qoi_compat) {
                 index_pos = QOI_COLOR_HASH(px) % QOI_INDEX_SIZE;
                 
-                qoi_found = (index[index_pos].v == px.v);
-                if (qoi_found) {
+                found = (index[index_pos].v == px.v);
+                if (found) {
                     bytes[p++] = QOI_OP_INDEX | index_pos;
                 }
                 else {
@@ -576,20 +2139,67 @@ void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
                         bytes[p++] = px.rgba.g;
                         bytes[p++] = px.rgba.b;
                         bytes[p++] = px.rgba.a;
-                        qoi_found = 1;
+                        found = 1;
                     }
                 }
             }
+            else if (index_cache) {
+                index_pos = QOI_COLOR_HASH(px) % SQOA_INDEX_SIZE;
+
+                found = (index[index_pos].v == px.v);
+                if (found) {
+                    bytes[p++] = SQOA_OP_INDEX + index_pos;
+                }
+                else {
+                    index[index_pos] = px;
+                }
+            }
             
-            if (!(qoi_compat && qoi_found)) {
-                signed char vr = px.rgba.r - px_prev.rgba.r;
-                signed char vg = px.rgba.g - px_prev.rgba.g;
-                signed char vb = px.rgba.b - px_prev.rgba.b;
+            if (!found) {
+                sqoa_rgba_t pred = px_prev;
+
+                if (predictor) {
+                    while (px_pos >= row_start + stride) {
+                        row_start += stride;
+                    }
+                    if (row_start > 0 || above) {
+                        const unsigned char *a = row_start > 0
+                            ? pixels + px_pos - stride
+                            : above + px_pos;
+                        sqoa_rgba_t up = px_prev, upleft = px_prev;
+                        up.rgba.r = a[0];
+                        up.rgba.g = a[1];
+                        up.rgba.b = a[2];
+                        if (px_pos > row_start) {
+                            upleft.rgba.r = a[0 - channels];
+                            upleft.rgba.g = a[1 - channels];
+                            upleft.rgba.b = a[2 - channels];
+                        }
+                        pred = sqoa_predict(
+                            px_prev, up, upleft,
+                            px_pos == row_start ? SQOA_PRED_UP : predictor
+                        );
+                    }
+                }
+
+                signed char vr = px.rgba.r - pred.rgba.r;
+                signed char vg = px.rgba.g - pred.rgba.g;
+                signed char vb = px.rgba.b - pred.rgba.b;
                 signed char va = px.rgba.a - px_prev.rgba.a;
                 signed char vg_r = vr - vg;
                 signed char vg_b = vb - vg;
                 int needs_alpha = (va != 0);
 
+                if (transform) {
+                    /* YCoCg-R lifting of the differences, Y takes the place of
+                    vg, Co of vg_r and Cg of vg_b */
+                    signed char t;
+                    vg_r = vr - vb;
+                    t = vb + (vg_r >> 1);
+                    vg_b = vg - t;
+                    vg = t + (vg_b >> 1);
+                }
+
                 if (
                     qoi_compat &&
                     vr > -3 && vr < 2 &&
@@ -598,11 +2208,6 @@ void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
                 ) {
                     bytes[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
                 }
-                else if (col_channels == 1 && needs_alpha) {
-                    bytes[p++] = SQOA_OP_RGBA;
-                    bytes[p++] = px.rgba.g;
-                    bytes[p++] = px.rgba.a;
-                }
                 else if (
                     vg_r >  -9 && vg_r <  8 &&
                     vg   > -33 && vg   < 32 &&
@@ -610,24 +2215,17 @@ void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
                     va   > -17 && va   < 16
                 ) {
                     bytes[p++] = SQOA_OP_LUMA | (vg + 32);
-                    if (col_channels == 3) {
-                        bytes[p++] = (vg_r + 8) << 4 | (vg_b + 8);
+                    bytes[p++] = (vg_r + 8) << 4 | (vg_b + 8);
 
-                        if (needs_alpha) {
-                            bytes[p++] = SQOA_OP_ALPHA | (va + 16);
-                        }
+                    if (needs_alpha) {
+                        bytes[p++] = SQOA_OP_ALPHA | (va + 16);
                     }
                 }
                 else {
                     bytes[p++] = SQOA_OP_RGB | needs_alpha;
-                    if (col_channels == 3) {
-                        bytes[p++] = px.rgba.r;
-                        bytes[p++] = px.rgba.g;
-                        bytes[p++] = px.rgba.b;
-                    }
-                    else {
-                        bytes[p++] = px.rgba.g;
-                    }
+                    bytes[p++] = px.rgba.r;
+                    bytes[p++] = px.rgba.g;
+                    bytes[p++] = px.rgba.b;
                     if (needs_alpha) {
                         bytes[p++] = px.rgba.a;
                     }
@@ -637,44 +2235,249 @@ void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
         }
     }
     
-    if (run > 0) {
-        bytes[p++] = SQOA_OP_BIGRUN;
+    enc->run = run;
+    enc->px_prev = px_prev;
+    return p;
+}
+
+/* The most bytes an image can be encoded to, or 0 if that does not fit an
+int */
+static int sqoa_encode_max_size(const sqoa_enc_t *enc) {
+    unsigned int max_size =
+        enc->desc.width * enc->desc.height * (enc->channels + 1) +
+        SQOA_HEADER_SIZE + 2 + 4 + sizeof(sqoa_padding);
+    return max_size > 0x7fffffff ? 0 : (int)max_size;
+}
+
+/* Encode the whole image into bytes, which has room for the most bytes it can
+be encoded to. Returns the size of the encoded image */
+static int sqoa_encode_image(sqoa_enc_t *enc, const unsigned char *pixels, unsigned char *bytes) {
+    int chunks_start, p, px_len;
+
+    p = chunks_start = sqoa_encode_header(enc, bytes);
+    px_len = enc->stride * enc->desc.height;
+
+    if (enc->col_channels == 1) {
+        p = sqoa_encode_mono(enc, pixels, NULL, px_len, bytes, p);
+    }
+    else {
+        p = sqoa_encode_color(enc, pixels, NULL, px_len, bytes, p);
     }
+    p = sqoa_encode_end(enc, bytes, p);
 
-    for (int i = 0; i < (int)sizeof(sqoa_padding); i++) {
-        bytes[p++] = sqoa_padding[i];
+    return sqoa_encode_finish(bytes, chunks_start, p, pixels, &enc->desc);
+}
+
+void *sqoa_encode(const void *data, const sqoa_desc *desc, int *out_len) {
+    sqoa_enc_t enc;
+    int max_size;
+    unsigned char *bytes;
+
+    if (data == NULL || out_len == NULL || desc == NULL || !sqoa_encode_init(&enc, desc)) {
+        return NULL;
     }
 
-    *out_len = p;
+    max_size = sqoa_encode_max_size(&enc);
+    if (!max_size) {
+        return NULL;
+    }
+    bytes = (unsigned char *) SQOA_MALLOC(max_size);
+    if (!bytes) {
+        return NULL;
+    }
+
+    *out_len = sqoa_encode_image(&enc, (const unsigned char *)data, bytes);
     return bytes;
 }
 
-void *sqoa_decode(const void *data, int size, sqoa_desc *desc, int channels) {
-    const unsigned char *bytes;
-    unsigned int header_magic;
-    unsigned char *pixels;
-    sqoa_rgba_t index[128];
-    sqoa_rgba_t px;
-    int px_len, chunks_len, px_pos, qoi_compat, index_size, col_channels;
-    int add_alpha = (channels & 1) == 0;
-    int p = 0, ref = -1, refp = 0, run = 0;
+int sqoa_encode_bound(const sqoa_desc *desc) {
+    sqoa_enc_t enc;
+
+    if (desc == NULL || !sqoa_encode_init(&enc, desc)) {
+        return 0;
+    }
+    return sqoa_encode_max_size(&enc);
+}
+
+int sqoa_encode_into(const void *data, const sqoa_desc *desc, void *bytes, int size) {
+    sqoa_enc_t enc;
+    int max_size;
+
+    if (data == NULL || desc == NULL || bytes == NULL || !sqoa_encode_init(&enc, desc)) {
+        return 0;
+    }
+
+    max_size = sqoa_encode_max_size(&enc);
+    if (!max_size || size < max_size) {
+        return 0;
+    }
+    return sqoa_encode_image(&enc, (const unsigned char *)data, (unsigned char *)bytes);
+}
+
+struct sqoa_encoder {
+    sqoa_enc_t enc;
+    sqoa_write_func write;
+    void *user;
+    unsigned char *buf, *above;
+    int buf_size, row_max, p, total, failed;
+    unsigned int rows, crc;
+};
+
+static void sqoa_encoder_flush(sqoa_encoder *e) {
+    if (e->p > 0 && !e->failed) {
+        if (e->enc.desc.checksum) {
+            e->crc = sqoa_crc32c_update(e->crc, e->buf, e->p);
+        }
+        if (e->write(e->user, e->buf, e->p)) {
+            e->total += e->p;
+        }
+        else {
+            e->failed = 1;
+        }
+    }
+    e->p = 0;
+}
+
+sqoa_encoder *sqoa_encoder_create(const sqoa_desc *desc, sqoa_write_func write, void *user) {
+    sqoa_encoder *e;
+
+    if (desc == NULL || write == NULL || desc->effort != 0) {
+        return NULL;
+    }
+    e = (sqoa_encoder *) SQOA_MALLOC(sizeof(sqoa_encoder));
+    if (!e) {
+        return NULL;
+    }
+    memset(e, 0, sizeof(sqoa_encoder));
+    if (!sqoa_encode_init(&e->enc, desc)) {
+        SQOA_FREE(e);
+        return NULL;
+    }
+
+    /* A row takes at most one byte more per pixel than its pixels, and the
+    RUN chunks of a run that goes on from the rows before: one per
+    max_op_run pixels, up to SQOA_MAXRUN */
+    e->row_max = e->enc.stride + desc->width + SQOA_MAXRUN / e->enc.max_op_run + 1;
+    e->buf_size = e->row_max + 65536;
+    e->buf = (unsigned char *) SQOA_MALLOC(e->buf_size);
+    if (e->enc.predictor) {
+        e->above = (unsigned char *) SQOA_MALLOC(e->enc.stride);
+    }
+    if (!e->buf || (e->enc.predictor && !e->above)) {
+        if (e->buf) {
+            SQOA_FREE(e->buf);
+        }
+        SQOA_FREE(e);
+        return NULL;
+    }
+
+    e->write = write;
+    e->user = user;
+    e->crc = 0xffffffff;
+    e->p = sqoa_encode_header(&e->enc, e->buf);
+    return e;
+}
+
+int sqoa_encoder_rows(sqoa_encoder *encoder, const void *rows, int row_count) {
+    const unsigned char *row = (const unsigned char *)rows;
+    const unsigned char *above;
+    int stride, i;
 
     if (
-        data == NULL || desc == NULL ||
-        channels > 4 ||
-        size < SQOA_HEADER_SIZE + (int)sizeof(sqoa_padding)
+        encoder == NULL || rows == NULL || row_count < 0 || encoder->failed ||
+        (unsigned int)row_count > encoder->enc.desc.height - encoder->rows
     ) {
-        return NULL;
+        if (encoder) {
+            encoder->failed = 1;
+        }
+        return 0;
     }
 
-    bytes = (const unsigned char *)data;
+    stride = encoder->enc.stride;
+    above = encoder->rows > 0 ? encoder->above : NULL;
+    for (i = 0; i < row_count; i++, row += stride) {
+        if (encoder->p + encoder->row_max > encoder->buf_size) {
+            sqoa_encoder_flush(encoder);
+        }
+        if (encoder->enc.col_channels == 1) {
+            encoder->p = sqoa_encode_mono(&encoder->enc, row, above, stride, encoder->buf, encoder->p);
+        }
+        else {
+            encoder->p = sqoa_encode_color(&encoder->enc, row, above, stride, encoder->buf, encoder->p);
+        }
+        above = row;
+    }
+
+    /* The caller may reuse the rows, keep the last one for the predictor */
+    if (encoder->above && row_count > 0) {
+        memcpy(encoder->above, row - stride, stride);
+    }
+    encoder->rows += row_count;
+    return !encoder->failed;
+}
+
+int sqoa_encoder_finish(sqoa_encoder *encoder) {
+    int total;
+
+    if (encoder == NULL) {
+        return 0;
+    }
+
+    if (encoder->rows == encoder->enc.desc.height) {
+        if (encoder->p + 16 > encoder->buf_size) {
+            sqoa_encoder_flush(encoder);
+        }
+        encoder->p = sqoa_encode_end(&encoder->enc, encoder->buf, encoder->p);
+        memcpy(encoder->buf + encoder->p, sqoa_padding, sizeof(sqoa_padding));
+        encoder->p += sizeof(sqoa_padding);
+        sqoa_encoder_flush(encoder);
+        if (encoder->enc.desc.checksum && !encoder->failed) {
+            unsigned char crc[4];
+            int q = 0;
+            sqoa_write_32(crc, &q, ~encoder->crc);
+            if (encoder->write(encoder->user, crc, q)) {
+                encoder->total += q;
+            }
+            else {
+                encoder->failed = 1;
+            }
+        }
+    }
+    else {
+        encoder->failed = 1;
+    }
+
+    total = encoder->failed ? 0 : encoder->total;
+    if (encoder->above) {
+        SQOA_FREE(encoder->above);
+    }
+    SQOA_FREE(encoder->buf);
+    SQOA_FREE(encoder);
+    return total;
+}
+
+/* Read the header, start byte and extension flags into desc. Returns the
+position of the first chunk, or 0 if the header is invalid. */
+static int sqoa_decode_header(const unsigned char *bytes, int size, sqoa_desc *desc) {
+    unsigned int header_magic;
+    int p = 0, extended;
+
+    if (size < SQOA_INFO_SIZE) {
+        return 0;
+    }
 
     header_magic = sqoa_read_32(bytes, &p);
     desc->width = sqoa_read_32(bytes, &p);
     desc->height = sqoa_read_32(bytes, &p);
     desc->channels = bytes[p++];
-    desc->colorspace = bytes[p++];
-    desc->qoi_compat = (bytes[p] != SQOA_START_BYTE);
+    desc->colorspace = bytes[p] & ~SQOA_EXT_COLORSPACE;
+    extended = (bytes[p++] & SQOA_EXT_COLORSPACE) != 0;
+    desc->qoi_compat = (bytes[p] != SQOA_START_BYTE && bytes[p] != SQOA_EXT_START_BYTE);
+    desc->index_cache = 0;
+    desc->predictor = SQOA_PRED_LEFT;
+    desc->transform = SQOA_TRANSFORM_NONE;
+    desc->effort = 0;
+    desc->checksum = 0;
 
     if (
         desc->width == 0 || desc->height == 0 ||
@@ -682,11 +2485,363 @@ void *sqoa_decode(const void *data, int size, sqoa_desc *desc, int channels) {
         desc->colorspace > 1 ||
         !(header_magic == QOI_MAGIC || header_magic == SQOA_MAGIC) ||
         (header_magic == QOI_MAGIC && !desc->qoi_compat) ||
+        extended != (!desc->qoi_compat && bytes[p] == SQOA_EXT_START_BYTE) ||
         desc->height >= SQOA_PIXELS_MAX / desc->width
+    ) {
+        return 0;
+    }
+
+    if (!desc->qoi_compat && bytes[p++] == SQOA_EXT_START_BYTE) {
+        int extensions = bytes[p++];
+        if (extensions & ~SQOA_EXT_KNOWN) {
+            return 0;
+        }
+        desc->index_cache = extensions & SQOA_EXT_INDEX;
+        desc->predictor = (extensions & SQOA_EXT_PRED) >> SQOA_EXT_PRED_SHIFT;
+        desc->transform = (extensions & SQOA_EXT_YCOCG) ? SQOA_TRANSFORM_YCOCG_R : SQOA_TRANSFORM_NONE;
+        desc->checksum = (extensions & SQOA_EXT_CRC) != 0;
+    }
+    return p;
+}
+
+/* Average the sums of a band of rows of a scaled decode into one output row,
+then clear the sums for the next band */
+static void sqoa_scale_row(
+    unsigned int *acc, unsigned char *out, int width, int shift, int rows,
+    int channels, int col_channels, int add_alpha
+) {
+    int out_w = (width + (1 << shift) - 1) >> shift;
+    int x;
+
+    for (x = 0; x < out_w; x++, acc += 4, out += channels) {
+        int cols = width - (x << shift);
+        unsigned int n, half;
+        if (cols > (1 << shift)) {
+            cols = 1 << shift;
+        }
+        n = cols * rows;
+        half = n >> 1;
+
+        if (channels >= 3 && col_channels == 3) {
+            out[0] = (acc[0] + half) / n;
+            out[1] = (acc[1] + half) / n;
+            out[2] = (acc[2] + half) / n;
+        }
+        else {
+            out[0] = (acc[1] + half) / n;
+            if (channels >= 3) {
+                out[1] = out[0];
+                out[2] = out[0];
+            }
+        }
+        if (add_alpha) {
+            out[channels - 1] = (acc[3] + half) / n;
+        }
+        acc[0] = acc[1] = acc[2] = acc[3] = 0;
+    }
+}
+
+/* Fill the pattern with copies of the pixel, 48 bytes being a multiple of
+every pixel size */
+static void sqoa_fill_pattern(unsigned char *pattern, const unsigned char *pixel, int channels) {
+    int i;
+    for (i = 0; i < 12; i += channels) {
+        memcpy(pattern + i, pixel, channels);
+    }
+    memcpy(pattern + 12, pattern, 12);
+    memcpy(pattern + 24, pattern, 24);
+}
+
+/* Write len bytes of the repeated 48 byte pattern */
+static void sqoa_fill_bytes(unsigned char *dst, const unsigned char *pattern, int len) {
+    for (; len >= 48; len -= 48, dst += 48) {
+        memcpy(dst, pattern, 48);
+    }
+    memcpy(dst, pattern, len);
+}
+
+#ifdef SQOA_X86_SIMD
+__attribute__((target("avx2")))
+static void sqoa_fill_bytes_avx2(unsigned char *dst, const unsigned char *pattern, int len) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)pattern);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(pattern + 32));
+    __m256i v2 = _mm256_loadu_si256((const __m256i *)(pattern + 64));
+    for (; len >= 96; len -= 96, dst += 96) {
+        _mm256_storeu_si256((__m256i *)dst, v0);
+        _mm256_storeu_si256((__m256i *)(dst + 32), v1);
+        _mm256_storeu_si256((__m256i *)(dst + 64), v2);
+    }
+    memcpy(dst, pattern, len);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void sqoa_fill_bytes_avx512(unsigned char *dst, const unsigned char *pattern, int len) {
+    __m512i v[3];
+    int i;
+    v[0] = _mm512_loadu_si512((const void *)pattern);
+    v[1] = _mm512_loadu_si512((const void *)(pattern + 64));
+    v[2] = _mm512_loadu_si512((const void *)(pattern + 128));
+    for (; len >= 192; len -= 192, dst += 192) {
+        _mm512_storeu_si512((void *)dst, v[0]);
+        _mm512_storeu_si512((void *)(dst + 64), v[1]);
+        _mm512_storeu_si512((void *)(dst + 128), v[2]);
+    }
+    for (i = 0; len > 0; i++, len -= 64, dst += 64) {
+        __mmask64 mask = len >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << len) - 1;
+        _mm512_mask_storeu_epi8(dst, mask, v[i]);
+    }
+}
+#endif
+
+/* Write count copies of a decoded pixel of channels bytes, for the rest of a
+run. Runs are up to SQOA_MAXRUN pixels, written with the widest
+stores of the SIMD level. */
+static void sqoa_fill_run(unsigned char *dst, const unsigned char *pixel, int channels, int count, int simd) {
+    unsigned char pattern[192];
+    int len = count * channels;
+
+    if (len <= 16) {
+        int i, j = 0;
+        for (i = 0; i < len; i++) {
+            dst[i] = pixel[j];
+            if (++j == channels) {
+                j = 0;
+            }
+        }
+        return;
+    }
+
+    sqoa_fill_pattern(pattern, pixel, channels);
+#ifdef SQOA_X86_SIMD
+    if (simd >= SQOA_SIMD_AVX2 && len >= 96) {
+        memcpy(pattern + 48, pattern, 48);
+        if (simd >= SQOA_SIMD_AVX512 && len >= 192) {
+            memcpy(pattern + 96, pattern, 96);
+            sqoa_fill_bytes_avx512(dst, pattern, len);
+        }
+        else {
+            sqoa_fill_bytes_avx2(dst, pattern, len);
+        }
+        return;
+    }
+#endif
+    (void)simd;
+    sqoa_fill_bytes(dst, pattern, len);
+}
+
+#ifdef SQOA_X86_SIMD
+/* Decode up to 8 SQOA_OP_LUMA chunks of a colour image at once, as many as
+start the next 16 bytes and are not followed by a SQOA_OP_ALPHA. The
+differences of the 8 pixels are summed up like a prefix sum, 4 pixels to a
+register, and the pixels written to dst as RGB or RGBA and to group as RGBA.
+The pixels after the decoded ones are garbage, dst must have room for 16
+pixels. Only for the left predictor without colour transform.
+
+Returns the number of pixels decoded, 0 if there are less than 2 LUMA
+chunks. */
+__attribute__((target("sse4.1")))
+static int sqoa_luma_color(
+    const unsigned char *bytes, sqoa_rgba_t *px, unsigned char *dst,
+    int channels, int check_alpha, sqoa_rgba_t *group
+) {
+    const __m128i none = _mm_set1_epi8((char)0x80);
+    __m128i in = _mm_loadu_si128((const __m128i *)bytes);
+    __m128i tags = _mm_cmpeq_epi8(_mm_and_si128(in, _mm_set1_epi8((char)SQOA_MASK_2)), none);
+    __m128i vg, vr, vb, bias, d0, d1, p0, p1;
+    int n = __builtin_ctz((~_mm_movemask_epi8(tags) & 0x5555) | 0x10000) >> 1;
+
+    if (check_alpha && bytes[n * 2] >= SQOA_OP_ALPHA && bytes[n * 2] < SQOA_OP_LUMA) {
+        n--;
+    }
+    if (n < 2) {
+        return 0;
+    }
+
+    /* vg in the even bytes, the high and low nibbles of the second bytes in
+    the odd ones; the biases -32 and -8 are added to each pixel at once */
+    vg = _mm_and_si128(in, _mm_set1_epi8(0x3f));
+    vr = _mm_and_si128(_mm_srli_epi16(in, 4), _mm_set1_epi8(0x0f));
+    vb = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+    bias = _mm_set1_epi32(0x00d8e0d8);
+
+    /* r = vg + vr, g = vg, b = vg + vb and no change of alpha, per pixel */
+    d0 = _mm_add_epi8(
+        _mm_add_epi8(
+            _mm_shuffle_epi8(vg, _mm_setr_epi8(0, 0, 0, -1, 2, 2, 2, -1, 4, 4, 4, -1, 6, 6, 6, -1)),
+            _mm_shuffle_epi8(vr, _mm_setr_epi8(1, -1, -1, -1, 3, -1, -1, -1, 5, -1, -1, -1, 7, -1, -1, -1))
+        ),
+        _mm_add_epi8(
+            _mm_shuffle_epi8(vb, _mm_setr_epi8(-1, -1, 1, -1, -1, -1, 3, -1, -1, -1, 5, -1, -1, -1, 7, -1)),
+            bias
+        )
+    );
+    d1 = _mm_add_epi8(
+        _mm_add_epi8(
+            _mm_shuffle_epi8(vg, _mm_setr_epi8(8, 8, 8, -1, 10, 10, 10, -1, 12, 12, 12, -1, 14, 14, 14, -1)),
+            _mm_shuffle_epi8(vr, _mm_setr_epi8(9, -1, -1, -1, 11, -1, -1, -1, 13, -1, -1, -1, 15, -1, -1, -1))
+        ),
+        _mm_add_epi8(
+            _mm_shuffle_epi8(vb, _mm_setr_epi8(-1, -1, 9, -1, -1, -1, 11, -1, -1, -1, 13, -1, -1, -1, 15, -1)),
+            bias
+        )
+    );
+
+    d0 = _mm_add_epi8(d0, _mm_slli_si128(d0, 4));
+    d0 = _mm_add_epi8(d0, _mm_slli_si128(d0, 8));
+    d1 = _mm_add_epi8(d1, _mm_slli_si128(d1, 4));
+    d1 = _mm_add_epi8(d1, _mm_slli_si128(d1, 8));
+    p0 = _mm_add_epi8(_mm_set1_epi32((int)px->v), d0);
+    p1 = _mm_add_epi8(_mm_shuffle_epi32(p0, 0xff), d1);
+
+    _mm_storeu_si128((__m128i *)group, p0);
+    _mm_storeu_si128((__m128i *)(group + 4), p1);
+    if (channels == 4) {
+        _mm_storeu_si128((__m128i *)dst, p0);
+        _mm_storeu_si128((__m128i *)(dst + 16), p1);
+    }
+    else {
+        /* The last 4 bytes of each store are overwritten by the next pixels */
+        const __m128i rgb = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(p0, rgb));
+        _mm_storeu_si128((__m128i *)(dst + 12), _mm_shuffle_epi8(p1, rgb));
+    }
+    *px = group[n - 1];
+    return n;
+}
+
+/* The same for up to 16 one byte SQOA_OP_LUMA chunks of a MONO or MONOA
+image, decoded to 1 or 2 channels */
+__attribute__((target("sse4.1")))
+static int sqoa_luma_mono(
+    const unsigned char *bytes, sqoa_rgba_t *px, unsigned char *dst,
+    int channels, sqoa_rgba_t *group
+) {
+    __m128i in = _mm_loadu_si128((const __m128i *)bytes);
+    __m128i tags = _mm_cmpeq_epi8(
+        _mm_and_si128(in, _mm_set1_epi8((char)SQOA_MASK_2)),
+        _mm_set1_epi8((char)SQOA_OP_LUMA)
+    );
+    __m128i d, g;
+    unsigned char gs[16];
+    int n = __builtin_ctz(~_mm_movemask_epi8(tags) | 0x10000), i;
+
+    if (bytes[n] >= SQOA_OP_ALPHA && bytes[n] < SQOA_OP_LUMA) {
+        n--;
+    }
+    if (n < 2) {
+        return 0;
+    }
+
+    d = _mm_add_epi8(_mm_and_si128(in, _mm_set1_epi8(0x3f)), _mm_set1_epi8(-32));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 1));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 2));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+    g = _mm_add_epi8(_mm_set1_epi8((char)px->rgba.g), d);
+
+    if (channels == 1) {
+        _mm_storeu_si128((__m128i *)dst, g);
+    }
+    else {
+        __m128i a = _mm_set1_epi8((char)px->rgba.a);
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(g, a));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(g, a));
+    }
+    _mm_storeu_si128((__m128i *)gs, g);
+    if (group) {
+        for (i = 0; i < n; i++) {
+            group[i] = *px;
+            group[i].rgba.g = gs[i];
+        }
+    }
+    px->rgba.g = gs[n - 1];
+    return n;
+}
+#endif
+
+/* Check that the chunk at p, and the SQOA_OP_ALPHA that may follow it, end
+within the chunks, following a SQOA_OP_REF like the decoder does. Only used
+for the last chunks: before chunks_len - SQOA_CHUNK_MAX every chunk fits. A
+SQOA_OP_REF before the chunks is left for the decoder to reject. */
+static int sqoa_chunk_fits(
+    const unsigned char *bytes, int p, int ref, int refp,
+    int chunks_start, int chunks_len, int qoi_compat, int col_channels
+) {
+    int b1, n;
+
+    if ((p == ref ? refp : p) >= chunks_len) {
+        return 0;
+    }
+    b1 = bytes[SQOA_NEXT(p, ref, refp)];
+
+    if (!qoi_compat && b1 < SQOA_OP_ALPHA) {
+        refp = p;
+        ref = p - (b1 & 31);
+        p = ref - 2 - (b1 >> 5);
+        if (p < chunks_start) {
+            return 1;
+        }
+        b1 = bytes[p++];
+    }
+
+    if (b1 == SQOA_OP_RGB || b1 == SQOA_OP_RGBA) {
+        n = col_channels + (b1 == SQOA_OP_RGBA);
+    }
+    else if ((b1 & SQOA_MASK_2) == SQOA_OP_LUMA && col_channels == 3) {
+        n = 1;
+    }
+    else {
+        n = 0;
+    }
+    while (n--) {
+        if ((p == ref ? refp : p) >= chunks_len) {
+            return 0;
+        }
+        (void)SQOA_NEXT(p, ref, refp);
+    }
+
+    /* The byte after the chunk is only read as SQOA_OP_ALPHA within the
+    chunks, past them it is the end marker */
+    return 1;
+}
+
+/* The decoder behind sqoa_decode. With a shift, it averages blocks of
+1 << shift pixels square into a smaller image. With a sink, it decodes one row
+at a time into a row buffer that is passed to the sink, which returns 0 to
+stop the decoding. Otherwise, the image is decoded into the into_size bytes
+of into if it is not NULL. */
+static void *sqoa_decode_shift(
+    const void *data, int size, sqoa_desc *desc, int channels, int shift,
+    unsigned char *into, int into_size,
+    int (*sink)(void *user, const unsigned char *line), void *user
+) {
+    const unsigned char *bytes;
+    unsigned char *pixels, *out = NULL;
+    unsigned int *acc = NULL;
+    sqoa_rgba_t index[128];
+    sqoa_rgba_t px, upleft, *row = NULL;
+    int px_len, chunks_start, chunks_len, chunks_safe, px_pos;
+    int qoi_compat, index_cache, index_size, col_channels;
+    int predictor, transform, stride, row_start = 0, x = 0, y = 0;
+    int add_alpha = (channels & 1) == 0;
+    int p = 0, ref = -1, refp = 0, run = 0;
+    int simd = sqoa_simd_level(), luma_fast;
+    sqoa_rgba_t group[16];
+
+    if (
+        data == NULL || desc == NULL ||
+        channels < 0 || channels > 4 ||
+        size < SQOA_HEADER_SIZE + (int)sizeof(sqoa_padding)
     ) {
         return NULL;
     }
-    
+
+    bytes = (const unsigned char *)data;
+    p = chunks_start = sqoa_decode_header(bytes, size, desc);
+    if (!p) {
+        return NULL;
+    }
+
     if (desc->channels < 3) {
         col_channels = 1;
         index_size = 128;
@@ -702,14 +2857,66 @@ void *sqoa_decode(const void *data, int size, sqoa_desc *desc, int channels) {
     }
     
     qoi_compat = desc->qoi_compat;
-    if (!qoi_compat && bytes[p++] != SQOA_START_BYTE) {
-        return NULL;
+    index_cache = desc->index_cache;
+    if (index_cache) {
+        index_size = SQOA_INDEX_SIZE;
     }
+    predictor = desc->predictor;
+    transform = desc->transform;
 
     px_len = desc->width * desc->height * channels;
-    pixels = (unsigned char *) SQOA_MALLOC(px_len);
-    if (!pixels) {
-        return NULL;
+    if (shift) {
+        /* Only the scaled image is stored, with the sums of the current band
+        of rows */
+        int out_w = (desc->width + (1 << shift) - 1) >> shift;
+        int out_h = (desc->height + (1 << shift) - 1) >> shift;
+        pixels = (unsigned char *) SQOA_MALLOC(out_w * out_h * channels);
+        acc = (unsigned int *) SQOA_MALLOC(out_w * 4 * sizeof(unsigned int));
+        if (!pixels || !acc) {
+            if (pixels) {
+                SQOA_FREE(pixels);
+            }
+            if (acc) {
+                SQOA_FREE(acc);
+            }
+            return NULL;
+        }
+        memset(acc, 0, out_w * 4 * sizeof(unsigned int));
+        out = pixels;
+    }
+    else if (sink) {
+        pixels = (unsigned char *) SQOA_MALLOC(desc->width * channels);
+        if (!pixels) {
+            return NULL;
+        }
+    }
+    else if (into) {
+        if (into_size < px_len) {
+            return NULL;
+        }
+        pixels = into;
+    }
+    else {
+        pixels = (unsigned char *) SQOA_MALLOC(px_len);
+        if (!pixels) {
+            return NULL;
+        }
+    }
+
+    /* The predictor reads the row above from the decoded pixels, unless they
+    lack some of the colour channels or are not kept */
+    stride = desc->width * channels;
+    if (predictor && ((col_channels == 3 && channels < 3) || shift || sink)) {
+        row = (sqoa_rgba_t *) SQOA_MALLOC(desc->width * sizeof(sqoa_rgba_t));
+        if (!row) {
+            if (acc) {
+                SQOA_FREE(acc);
+            }
+            if (pixels != into) {
+                SQOA_FREE(pixels);
+            }
+            return NULL;
+        }
     }
 
     SQOA_ZEROARR(index);
@@ -717,21 +2924,69 @@ void *sqoa_decode(const void *data, int size, sqoa_desc *desc, int channels) {
     px.rgba.g = 0;
     px.rgba.b = 0;
     px.rgba.a = 255;
-
-    chunks_len = size - (int)sizeof(sqoa_padding);
+    upleft.v = 0;
+
+    /* Sequences of LUMA chunks are decoded several at once when each pixel
+    only depends on the one before */
+    luma_fast =
+        simd >= SQOA_SIMD_SSE41 && !predictor && !transform && !shift && !sink &&
+        (col_channels == 3 ? channels >= 3 : channels < 3);
+
+    /* Chunks that start before chunks_safe are read without checks, those
+    after it only if they end within the chunks. When the chunks run out, the
+    last pixel is repeated */
+    chunks_len = size - (int)sizeof(sqoa_padding) - (desc->checksum ? 4 : 0);
+    chunks_safe = chunks_len - SQOA_CHUNK_MAX;
     for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+#ifdef SQOA_X86_SIMD
+        if (
+            luma_fast && run == 0 && p > ref && p + 17 <= chunks_len &&
+            px_pos + 16 * channels <= px_len &&
+            (bytes[p] & SQOA_MASK_2) == SQOA_OP_LUMA
+        ) {
+            int n, i;
+            if (col_channels == 3) {
+                n = sqoa_luma_color(bytes + p, &px, pixels + px_pos, channels, !qoi_compat, group);
+                p += n * 2;
+            }
+            else {
+                n = sqoa_luma_mono(bytes + p, &px, pixels + px_pos, channels, qoi_compat || index_cache ? group : NULL);
+                p += n;
+            }
+            if (n > 0) {
+                if (qoi_compat || index_cache) {
+                    for (i = 0; i < n; i++) {
+                        index[QOI_COLOR_HASH(group[i]) % index_size] = group[i];
+                    }
+                }
+                px_pos += (n - 1) * channels;
+                continue;
+            }
+        }
+#endif
         if (run > 0) {
             run--;
         }
-        else if (p < chunks_len) {
+        else if (
+            (p < chunks_safe && refp < chunks_safe) ||
+            sqoa_chunk_fits(bytes, p, ref, refp, chunks_start, chunks_len, qoi_compat, col_channels)
+        ) {
             int b1 = bytes[SQOA_NEXT(p, ref, refp)];
             
             if (!qoi_compat && b1 < SQOA_OP_ALPHA) {
                 refp = p;
                 ref = p - (b1 & 31);
                 p = ref - 2 - (b1 >> 5);
-                if (p < 0) {
-                    SQOA_FREE(pixels);
+                if (p < chunks_start) {
+                    if (row) {
+                        SQOA_FREE(row);
+                    }
+                    if (acc) {
+                        SQOA_FREE(acc);
+                    }
+                    if (pixels != into) {
+                        SQOA_FREE(pixels);
+                    }
                     return NULL;
                 }
                 b1 = bytes[p++];
@@ -760,54 +3015,1293 @@ void *sqoa_decode(const void *data, int size, sqoa_desc *desc, int channels) {
             }
             else if ((b1 & SQOA_MASK_2) == SQOA_OP_LUMA) {
                 int vg = (b1 & 0x3f) - 32;
-                px.rgba.g += vg;
+                if (predictor) {
+                    while (px_pos >= row_start + stride) {
+                        row_start += stride;
+                    }
+                    if (row_start > 0) {
+                        sqoa_rgba_t up = px;
+                        if (row) {
+                            up = row[x];
+                        }
+                        else {
+                            const unsigned char *above = pixels + px_pos - stride;
+                            upleft = px;
+                            if (col_channels == 3) {
+                                up.rgba.r = above[0];
+                                up.rgba.g = above[1];
+                                up.rgba.b = above[2];
+                                if (px_pos > row_start) {
+                                    upleft.rgba.r = above[0 - channels];
+                                    upleft.rgba.g = above[1 - channels];
+                                    upleft.rgba.b = above[2 - channels];
+                                }
+                            }
+                            else {
+                                up.rgba.g = above[0];
+                                if (px_pos > row_start) {
+                                    upleft.rgba.g = above[0 - channels];
+                                }
+                            }
+                        }
+                        px = sqoa_predict(
+                            px, up, upleft,
+                            px_pos == row_start ? SQOA_PRED_UP : predictor
+                        );
+                    }
+                }
                 if (col_channels == 3) {
                     int b2 = bytes[SQOA_NEXT(p, ref, refp)];
-                    px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
-                    px.rgba.b += vg - 8 +  (b2       & 0x0f);
+                    int vr = ((b2 >> 4) & 0x0f) - 8;
+                    int vb =  (b2       & 0x0f) - 8;
+                    if (transform) {
+                        /* Undo the YCoCg-R lifting: vg is Y, vr Co, vb Cg */
+                        int t = vg - (vb >> 1);
+                        vg = vb + t;
+                        vb = t - (vr >> 1);
+                        vr = vb + vr;
+                    }
+                    else {
+                        vr += vg;
+                        vb += vg;
+                    }
+                    px.rgba.r += vr;
+                    px.rgba.b += vb;
                 }
+                px.rgba.g += vg;
             }
             else if (!qoi_compat && b1 == SQOA_OP_BIGRUN) {
                 run = SQOA_MAXRUN - 1;
             }
+            else if (index_cache && b1 >= SQOA_OP_INDEX) {
+                px = index[b1 - SQOA_OP_INDEX];
+            }
             else {
                 run = (b1 & 0x3f);
             }
 
             if (
-                !qoi_compat && col_channels == 3 &&
-                bytes[p] >= SQOA_OP_ALPHA && bytes[p] < SQOA_OP_LUMA
+                !qoi_compat &&
+                bytes[p == ref ? refp : p] >= SQOA_OP_ALPHA &&
+                bytes[p == ref ? refp : p] < SQOA_OP_LUMA
             ) {
                 b1 = bytes[SQOA_NEXT(p, ref, refp)];
                 px.rgba.a = px.rgba.a + (b1 & 0x1f) - 16;
             }
             
-            if (qoi_compat) {
+            if (qoi_compat || index_cache) {
                 index[QOI_COLOR_HASH(px) % index_size] = px;
             }
         }
 
-        if (channels >= 3 && col_channels == 3) {
-            pixels[px_pos + 0] = px.rgba.r;
-            pixels[px_pos + 1] = px.rgba.g;
-            pixels[px_pos + 2] = px.rgba.b;
+        if (shift) {
+            unsigned int *sum = acc + (x >> shift) * 4;
+            sum[0] += px.rgba.r;
+            sum[1] += px.rgba.g;
+            sum[2] += px.rgba.b;
+            sum[3] += px.rgba.a;
         }
         else {
-            pixels[px_pos] = px.rgba.g;
+            unsigned char *dst = sink ? pixels + x * channels : pixels + px_pos;
             if (channels >= 3) {
-                pixels[px_pos + 1] = px.rgba.g;
-                pixels[px_pos + 2] = px.rgba.g;
-            }
+                /* Expand grey to RGB in the register, RGBA is a single store */
+                sqoa_rgba_t out = px;
+                if (col_channels == 1) {
+                    out.rgba.r = px.rgba.g;
+                    out.rgba.b = px.rgba.g;
+                }
+                if (channels == 4) {
+                    memcpy(dst, &out, 4);
+                }
+                else {
+                    dst[0] = out.rgba.r;
+                    dst[1] = out.rgba.g;
+                    dst[2] = out.rgba.b;
+                }
+            }
+            else {
+                dst[0] = px.rgba.g;
+                if (add_alpha) {
+                    dst[1] = px.rgba.a;
+                }
+            }
+
+            /* The rest of a run is the same pixel, written all at once unless
+            the predictor needs each pixel in its row */
+            if (run > 0 && !row && !sink) {
+                int count = (px_len - px_pos) / channels - 1;
+                if (count > run) {
+                    count = run;
+                }
+                sqoa_fill_run(dst + channels, dst, channels, count, simd);
+                px_pos += count * channels;
+                run -= count;
+            }
+        }
+
+        if (row) {
+            upleft = row[x];
+            row[x] = px;
+        }
+        if ((row || shift || sink) && ++x == (int)desc->width) {
+            x = 0;
+            y++;
+            if (sink && !sink(user, pixels)) {
+                if (row) {
+                    SQOA_FREE(row);
+                }
+                SQOA_FREE(pixels);
+                return NULL;
+            }
+            /* A band is complete every 1 << shift rows, or at the last row */
+            if (shift && ((y & ((1 << shift) - 1)) == 0 || y == (int)desc->height)) {
+                int rows = ((y - 1) & ((1 << shift) - 1)) + 1;
+                sqoa_scale_row(
+                    acc, out, desc->width, shift, rows,
+                    channels, col_channels, add_alpha
+                );
+                out += ((desc->width + (1 << shift) - 1) >> shift) * channels;
+            }
+        }
+    }
+
+    if (row) {
+        SQOA_FREE(row);
+    }
+    if (acc) {
+        SQOA_FREE(acc);
+    }
+    return pixels;
+}
+
+void *sqoa_decode(const void *data, int size, sqoa_desc *desc, int channels) {
+    return sqoa_decode_shift(data, size, desc, channels, 0, NULL, 0, NULL, NULL);
+}
+
+int sqoa_decode_into(const void *data, int size, sqoa_desc *desc, int channels, void *pixels, int pixels_size) {
+    if (pixels == NULL) {
+        return 0;
+    }
+    return sqoa_decode_shift(
+        data, size, desc, channels, 0,
+        (unsigned char *)pixels, pixels_size, NULL, NULL
+    ) != NULL;
+}
+
+void *sqoa_decode_scaled(const void *data, int size, sqoa_desc *desc, int channels, int scale) {
+    int shift;
+
+    switch (scale) {
+        case 1: shift = 0; break;
+        case 2: shift = 1; break;
+        case 4: shift = 2; break;
+        case 8: shift = 3; break;
+        default: return NULL;
+    }
+    return sqoa_decode_shift(data, size, desc, channels, shift, NULL, 0, NULL, NULL);
+}
+
+static int sqoa_transcode_row(void *user, const unsigned char *line) {
+    return sqoa_encoder_rows((sqoa_encoder *)user, line, 1);
+}
+
+int sqoa_transcode(const void *data, int size, const sqoa_desc *options, sqoa_write_func write, void *user) {
+    sqoa_desc src, dst;
+    sqoa_encoder *encoder;
+    void *line;
+
+    if (
+        data == NULL || options == NULL || write == NULL ||
+        !sqoa_info(data, size, &src)
+    ) {
+        return 0;
+    }
+
+    memset(&dst, 0, sizeof(sqoa_desc));
+    dst.width = src.width;
+    dst.height = src.height;
+    dst.channels = src.channels;
+    dst.colorspace = src.colorspace;
+    dst.qoi_compat = options->qoi_compat;
+    dst.index_cache = options->index_cache;
+    dst.predictor = options->predictor;
+    dst.transform = options->transform;
+    dst.checksum = options->checksum;
+    if (dst.qoi_compat && dst.channels < 3) {
+        dst.channels += 2;
+    }
+
+    encoder = sqoa_encoder_create(&dst, write, user);
+    if (!encoder) {
+        return 0;
+    }
+    /* The encoder takes BGR and BGRA rows as RGB and RGBA */
+    line = sqoa_decode_shift(
+        data, size, &src, (dst.channels < 3 ? 1 : 3) + ((dst.channels & 1) == 0),
+        0, NULL, 0, sqoa_transcode_row, encoder
+    );
+    if (line) {
+        SQOA_FREE(line);
+    }
+    else {
+        /* Make sure the encoder fails even if the source was cut short */
+        sqoa_encoder_rows(encoder, NULL, 0);
+    }
+    return sqoa_encoder_finish(encoder);
+}
+
+/* The bytes kept before the chunk being decoded, for the SQOA_OP_REF chunks
+that go back to them: a reference goes back at most 41 bytes, more when it
+leads to another reference */
+#define SQOA_DECODER_KEEP 256
+
+struct sqoa_decoder {
+    sqoa_desc desc;
+    unsigned char *buf, *line;
+    sqoa_rgba_t *row;
+    sqoa_rgba_t index[128];
+    sqoa_rgba_t px, upleft;
+    int buf_len, buf_size, channels, add_alpha, col_channels, index_size;
+    int chunks_start, p, ref, refp, run, x, failed;
+    unsigned int y, crc;
+};
+
+sqoa_decoder *sqoa_decoder_create(int channels) {
+    sqoa_decoder *d;
+
+    if (channels < 0 || channels > 4) {
+        return NULL;
+    }
+    d = (sqoa_decoder *) SQOA_MALLOC(sizeof(sqoa_decoder));
+    if (!d) {
+        return NULL;
+    }
+    memset(d, 0, sizeof(sqoa_decoder));
+    d->channels = channels;
+    d->ref = -1;
+    d->crc = 0xffffffff;
+    return d;
+}
+
+/* Set up the decoding once the header is read */
+static int sqoa_decoder_start(sqoa_decoder *d) {
+    d->p = d->chunks_start = sqoa_decode_header(d->buf, d->buf_len, &d->desc);
+    if (!d->p) {
+        return 0;
+    }
+
+    if (d->desc.channels < 3) {
+        d->col_channels = 1;
+        d->index_size = 128;
+    }
+    else {
+        d->col_channels = 3;
+        d->index_size = 64;
+    }
+    if (d->desc.index_cache) {
+        d->index_size = SQOA_INDEX_SIZE;
+    }
+    if (d->channels == 0) {
+        d->add_alpha = (d->desc.channels & 1) == 0;
+        d->channels = d->col_channels + d->add_alpha;
+    }
+    else {
+        d->add_alpha = (d->channels & 1) == 0;
+    }
+
+    d->line = (unsigned char *) SQOA_MALLOC(d->desc.width * d->channels);
+    if (!d->line) {
+        return 0;
+    }
+    if (d->desc.predictor) {
+        d->row = (sqoa_rgba_t *) SQOA_MALLOC(d->desc.width * sizeof(sqoa_rgba_t));
+        if (!d->row) {
+            return 0;
+        }
+    }
+    d->px.rgba.a = 255;
+    return 1;
+}
+
+int sqoa_decoder_feed(sqoa_decoder *decoder, const void *data, int size) {
+    sqoa_decoder *d = decoder;
+
+    if (
+        d == NULL || d->failed || size < 0 || (data == NULL && size > 0) ||
+        size > 0x7fffffff - d->buf_len
+    ) {
+        if (d) {
+            d->failed = 1;
+        }
+        return 0;
+    }
+
+    if (d->buf_len + size > d->buf_size) {
+        /* Drop the bytes that were decoded, but those a reference may go back
+        to. Positions below 0 after that are past the start of the buffer. */
+        int drop = d->chunks_start ? d->p - SQOA_DECODER_KEEP : 0;
+        if (drop > 0) {
+            if (d->desc.checksum) {
+                d->crc = sqoa_crc32c_update(d->crc, d->buf, drop);
+            }
+            d->buf_len -= drop;
+            memmove(d->buf, d->buf + drop, d->buf_len);
+            d->chunks_start -= drop;
+            d->p -= drop;
+            d->ref -= drop;
+            d->refp -= drop;
+        }
+    }
+    if (d->buf_len + size > d->buf_size) {
+        unsigned char *buf;
+        int buf_size = d->buf_len + size;
+        if (buf_size < 0x3fffffff) {
+            buf_size *= 2;
+        }
+        if (buf_size < 4096) {
+            buf_size = 4096;
+        }
+        buf = (unsigned char *) SQOA_MALLOC(buf_size);
+        if (!buf) {
+            d->failed = 1;
+            return 0;
+        }
+        if (d->buf) {
+            memcpy(buf, d->buf, d->buf_len);
+            SQOA_FREE(d->buf);
+        }
+        d->buf = buf;
+        d->buf_size = buf_size;
+    }
+    if (size > 0) {
+        memcpy(d->buf + d->buf_len, data, size);
+        d->buf_len += size;
+    }
+
+    if (!d->chunks_start && d->buf_len >= SQOA_INFO_SIZE && !sqoa_decoder_start(d)) {
+        d->failed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+int sqoa_decoder_info(const sqoa_decoder *decoder, sqoa_desc *desc) {
+    if (decoder == NULL || desc == NULL || !decoder->line) {
+        return 0;
+    }
+    *desc = decoder->desc;
+    return 1;
+}
+
+const void *sqoa_decoder_row(sqoa_decoder *decoder) {
+    sqoa_decoder *d = decoder;
+    const unsigned char *bytes;
+    int width, channels, qoi_compat, index_cache, predictor, transform;
+
+    if (d == NULL || d->failed || !d->line || d->y == d->desc.height) {
+        return NULL;
+    }
+
+    bytes = d->buf;
+    width = d->desc.width;
+    channels = d->channels;
+    qoi_compat = d->desc.qoi_compat;
+    index_cache = d->desc.index_cache;
+    predictor = d->desc.predictor;
+    transform = d->desc.transform;
+
+    /* Decode the chunks like sqoa_decode does, one pixel at a time. The row
+    and the run go on from where the last call stopped. */
+    while (d->x < width) {
+        unsigned char *dst = d->line + d->x * channels;
+
+        if (d->run > 0) {
+            d->run--;
+        }
+        else {
+            int b1;
+
+            /* Wait for the whole chunk, it may end after the reference */
+            if ((d->p > d->ref ? d->p : d->refp) + SQOA_CHUNK_MAX > d->buf_len) {
+                return NULL;
+            }
+            b1 = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+
+            if (!qoi_compat && b1 < SQOA_OP_ALPHA) {
+                d->refp = d->p;
+                d->ref = d->p - (b1 & 31);
+                d->p = d->ref - 2 - (b1 >> 5);
+                if (d->p < d->chunks_start || d->p < 0) {
+                    d->failed = 1;
+                    return NULL;
+                }
+                b1 = bytes[d->p++];
+            }
+
+            if (b1 == SQOA_OP_RGB || b1 == SQOA_OP_RGBA) {
+                if (d->col_channels == 3) {
+                    d->px.rgba.r = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+                    d->px.rgba.g = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+                    d->px.rgba.b = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+                }
+                else {
+                    d->px.rgba.g = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+                }
+                if (b1 == SQOA_OP_RGBA) {
+                    d->px.rgba.a = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+                }
+            }
+            else if (qoi_compat && b1 < d->index_size) {
+                d->px = d->index[b1];
+            }
+            else if (qoi_compat && (b1 & SQOA_MASK_2) == QOI_OP_DIFF) {
+                d->px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+                d->px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+                d->px.rgba.b += ( b1       & 0x03) - 2;
+            }
+            else if ((b1 & SQOA_MASK_2) == SQOA_OP_LUMA) {
+                int vg = (b1 & 0x3f) - 32;
+                if (predictor && d->y > 0) {
+                    d->px = sqoa_predict(
+                        d->px, d->row[d->x], d->upleft,
+                        d->x == 0 ? SQOA_PRED_UP : predictor
+                    );
+                }
+                if (d->col_channels == 3) {
+                    int b2 = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+                    int vr = ((b2 >> 4) & 0x0f) - 8;
+                    int vb =  (b2       & 0x0f) - 8;
+                    if (transform) {
+                        int t = vg - (vb >> 1);
+                        vg = vb + t;
+                        vb = t - (vr >> 1);
+                        vr = vb + vr;
+                    }
+                    else {
+                        vr += vg;
+                        vb += vg;
+                    }
+                    d->px.rgba.r += vr;
+                    d->px.rgba.b += vb;
+                }
+                d->px.rgba.g += vg;
+            }
+            else if (!qoi_compat && b1 == SQOA_OP_BIGRUN) {
+                d->run = SQOA_MAXRUN - 1;
+            }
+            else if (index_cache && b1 >= SQOA_OP_INDEX) {
+                d->px = d->index[b1 - SQOA_OP_INDEX];
+            }
+            else {
+                d->run = (b1 & 0x3f);
+            }
+
+            if (
+                !qoi_compat &&
+                bytes[d->p == d->ref ? d->refp : d->p] >= SQOA_OP_ALPHA &&
+                bytes[d->p == d->ref ? d->refp : d->p] < SQOA_OP_LUMA
+            ) {
+                b1 = bytes[SQOA_NEXT(d->p, d->ref, d->refp)];
+                d->px.rgba.a = d->px.rgba.a + (b1 & 0x1f) - 16;
+            }
+
+            if (qoi_compat || index_cache) {
+                d->index[QOI_COLOR_HASH(d->px) % d->index_size] = d->px;
+            }
+        }
+
+        if (channels >= 3) {
+            sqoa_rgba_t out = d->px;
+            if (d->col_channels == 1) {
+                out.rgba.r = d->px.rgba.g;
+                out.rgba.b = d->px.rgba.g;
+            }
+            if (channels == 4) {
+                memcpy(dst, &out, 4);
+            }
+            else {
+                dst[0] = out.rgba.r;
+                dst[1] = out.rgba.g;
+                dst[2] = out.rgba.b;
+            }
+        }
+        else {
+            dst[0] = d->px.rgba.g;
+            if (d->add_alpha) {
+                dst[1] = d->px.rgba.a;
+            }
+        }
+
+        if (d->row) {
+            d->upleft = d->row[d->x];
+            d->row[d->x] = d->px;
+        }
+        else if (d->run > 0) {
+            /* The rest of the run within the row is the same pixel */
+            int count = width - d->x - 1;
+            if (count > d->run) {
+                count = d->run;
+            }
+            sqoa_fill_run(dst + channels, dst, channels, count, sqoa_simd_level());
+            d->x += count;
+            d->run -= count;
+        }
+        d->x++;
+    }
+
+    d->x = 0;
+    d->y++;
+    return d->line;
+}
+
+int sqoa_decoder_finish(sqoa_decoder *decoder) {
+    sqoa_decoder *d = decoder;
+    int result, end;
+
+    if (d == NULL) {
+        return 0;
+    }
+
+    /* The end marker must follow the chunk of the last pixel, and the
+    checksum cover all the bytes before it */
+    end = d->p == d->ref ? d->refp : d->p;
+    result =
+        !d->failed && d->line && d->y == d->desc.height && d->p >= d->ref &&
+        d->buf_len - end == (int)sizeof(sqoa_padding) + (d->desc.checksum ? 4 : 0) &&
+        memcmp(d->buf + end, sqoa_padding, sizeof(sqoa_padding)) == 0;
+    if (result && d->desc.checksum) {
+        int crc_pos = d->buf_len - 4;
+        d->crc = sqoa_crc32c_update(d->crc, d->buf, crc_pos);
+        result = sqoa_read_32(d->buf, &crc_pos) == ~d->crc;
+    }
+
+    if (d->row) {
+        SQOA_FREE(d->row);
+    }
+    if (d->line) {
+        SQOA_FREE(d->line);
+    }
+    if (d->buf) {
+        SQOA_FREE(d->buf);
+    }
+    SQOA_FREE(d);
+    return result;
+}
+
+int sqoa_info(const void *data, int size, sqoa_desc *desc) {
+    if (data == NULL || desc == NULL) {
+        return 0;
+    }
+    return sqoa_decode_header((const unsigned char *)data, size, desc) != 0;
+}
+
+/* The walk behind sqoa_validate, that also counts the chunks by kind if
+counts is not NULL */
+static int sqoa_walk(const void *data, int size, sqoa_desc *desc, unsigned int *counts) {
+    const unsigned char *bytes;
+    int p, chunks_start, chunks_len, col_channels, qoi_compat, index_cache;
+    int ref = -1, refp = 0;
+    unsigned int px_len, px_pos = 0, unused[SQOA_HIST_COUNT];
+
+    if (data == NULL || desc == NULL) {
+        return 0;
+    }
+    if (!counts) {
+        counts = unused;
+    }
+    memset(counts, 0, SQOA_HIST_COUNT * sizeof(unsigned int));
+
+    bytes = (const unsigned char *)data;
+    p = chunks_start = sqoa_decode_header(bytes, size, desc);
+    if (!p) {
+        return 0;
+    }
+
+    chunks_len = size - (int)sizeof(sqoa_padding) - (desc->checksum ? 4 : 0);
+    if (
+        chunks_len < chunks_start ||
+        memcmp(bytes + chunks_len, sqoa_padding, sizeof(sqoa_padding)) != 0
+    ) {
+        return 0;
+    }
+    if (desc->checksum) {
+        int crc_pos = size - 4;
+        if (sqoa_read_32(bytes, &crc_pos) != sqoa_crc32c(bytes, size - 4)) {
+            return 0;
+        }
+    }
+
+    col_channels = desc->channels < 3 ? 1 : 3;
+    qoi_compat = desc->qoi_compat;
+    index_cache = desc->index_cache;
+    px_len = desc->width * desc->height;
+
+    /* Walk the chunks like sqoa_decode does, only counting the pixels */
+    while (px_pos < px_len) {
+        int b1;
+        if ((p == ref ? refp : p) >= chunks_len) {
+            return 0;
+        }
+        b1 = bytes[SQOA_NEXT(p, ref, refp)];
+
+        if (!qoi_compat && b1 < SQOA_OP_ALPHA) {
+            refp = p;
+            ref = p - (b1 & 31);
+            p = ref - 2 - (b1 >> 5);
+            if (p < chunks_start || bytes[p] < SQOA_OP_LUMA) {
+                return 0;
+            }
+            b1 = bytes[p++];
+            counts[SQOA_HIST_REF]++;
+        }
+
+        if (b1 == SQOA_OP_RGB || b1 == SQOA_OP_RGBA) {
+            int n = col_channels + (b1 == SQOA_OP_RGBA);
+            while (n--) {
+                (void)SQOA_NEXT(p, ref, refp);
+            }
+            px_pos++;
+            counts[b1 == SQOA_OP_RGBA ? SQOA_HIST_RGBA : SQOA_HIST_RGB]++;
+        }
+        else if (qoi_compat && b1 < SQOA_OP_LUMA) {
+            px_pos++;
+            counts[(b1 & SQOA_MASK_2) == QOI_OP_DIFF ? SQOA_HIST_DIFF : SQOA_HIST_INDEX]++;
+        }
+        else if ((b1 & SQOA_MASK_2) == SQOA_OP_LUMA) {
+            if (col_channels == 3) {
+                (void)SQOA_NEXT(p, ref, refp);
+            }
+            px_pos++;
+            counts[SQOA_HIST_LUMA]++;
+        }
+        else if (!qoi_compat && b1 == SQOA_OP_BIGRUN) {
+            px_pos += SQOA_MAXRUN;
+            counts[SQOA_HIST_BIGRUN]++;
+        }
+        else if (index_cache && b1 >= SQOA_OP_INDEX) {
+            px_pos++;
+            counts[SQOA_HIST_INDEX]++;
+        }
+        else if (b1 >= SQOA_OP_RUN) {
+            px_pos += (b1 & 0x3f) + 1;
+            counts[SQOA_HIST_RUN]++;
+        }
+        else {
+            /* SQOA_OP_ALPHA only follows another chunk */
+            return 0;
+        }
+
+        if (
+            !qoi_compat &&
+            bytes[p == ref ? refp : p] >= SQOA_OP_ALPHA &&
+            bytes[p == ref ? refp : p] < SQOA_OP_LUMA
+        ) {
+            (void)SQOA_NEXT(p, ref, refp);
+            counts[SQOA_HIST_ALPHA]++;
+        }
+    }
+
+    /* Nothing may follow the chunk that covers the last pixel */
+    return (p == ref ? refp : p) == chunks_len;
+}
+
+int sqoa_validate(const void *data, int size, sqoa_desc *desc) {
+    return sqoa_walk(data, size, desc, NULL);
+}
+
+int sqoa_histogram(const void *data, int size, sqoa_desc *desc, unsigned int *counts) {
+    if (counts == NULL) {
+        return 0;
+    }
+    return sqoa_walk(data, size, desc, counts);
+}
+
+#define SQAN_HEADER_SIZE 18
+#define SQAN_FRAME_SIZE  9
+#define SQAN_MAGIC \
+    (((unsigned int)'S') << 24 | ((unsigned int)'q') << 16 | \
+     ((unsigned int)'a') <<  8 | ((unsigned int)'n'))
+
+void *sqoa_anim_encode(const void *const *frames, int frame_count, const sqoa_desc *desc, int key_interval, int *out_len) {
+    void **images;
+    int *sizes;
+    unsigned char *bytes, *delta = NULL;
+    int i, p, px_len, total, failed = 0;
+
+    if (
+        frames == NULL || desc == NULL || out_len == NULL ||
+        frame_count < 1 || frame_count > 0x7fffffff / SQAN_FRAME_SIZE ||
+        desc->channels < 1 || desc->channels > 6 ||
+        desc->width == 0 || desc->height == 0 ||
+        desc->height >= SQOA_PIXELS_MAX / desc->width
+    ) {
+        return NULL;
+    }
+
+    px_len = desc->width * desc->height *
+        ((desc->channels < 3 ? 1 : 3) + ((desc->channels & 1) == 0));
+    images = (void **) SQOA_MALLOC(frame_count * sizeof(void *));
+    sizes = (int *) SQOA_MALLOC(frame_count * sizeof(int));
+    if (frame_count > 1) {
+        delta = (unsigned char *) SQOA_MALLOC(px_len);
+    }
+    if (!images || !sizes || (frame_count > 1 && !delta)) {
+        failed = 1;
+        frame_count = 0;
+    }
+
+    total = SQAN_HEADER_SIZE + frame_count * SQAN_FRAME_SIZE;
+    for (i = 0; i < frame_count; i++) {
+        if (i == 0 || (key_interval > 0 && i % key_interval == 0)) {
+            images[i] = sqoa_encode(frames[i], desc, &sizes[i]);
+        }
+        else {
+            const unsigned char *cur = (const unsigned char *)frames[i];
+            const unsigned char *prev = (const unsigned char *)frames[i - 1];
+            int j;
+            for (j = 0; j < px_len; j++) {
+                delta[j] = cur[j] - prev[j];
+            }
+            images[i] = sqoa_encode(delta, desc, &sizes[i]);
+        }
+        if (!images[i]) {
+            failed = 1;
+            frame_count = i;
+            break;
+        }
+        /* The whole animation must fit an int size */
+        if (sizes[i] > 0x7fffffff - total) {
+            failed = 1;
+            frame_count = i + 1;
+            break;
+        }
+        total += sizes[i];
+    }
+
+    bytes = failed ? NULL : (unsigned char *) SQOA_MALLOC(total);
+    if (bytes) {
+        int offset = SQAN_HEADER_SIZE + frame_count * SQAN_FRAME_SIZE;
+        p = 0;
+        sqoa_write_32(bytes, &p, SQAN_MAGIC);
+        sqoa_write_32(bytes, &p, desc->width);
+        sqoa_write_32(bytes, &p, desc->height);
+        bytes[p++] = desc->channels;
+        bytes[p++] = desc->colorspace;
+        sqoa_write_32(bytes, &p, frame_count);
+        for (i = 0; i < frame_count; i++) {
+            sqoa_write_32(bytes, &p, offset);
+            sqoa_write_32(bytes, &p, sizes[i]);
+            bytes[p++] = i == 0 || (key_interval > 0 && i % key_interval == 0);
+            memcpy(bytes + offset, images[i], sizes[i]);
+            offset += sizes[i];
+        }
+        *out_len = total;
+    }
+
+    for (i = 0; i < frame_count; i++) {
+        SQOA_FREE(images[i]);
+    }
+    if (images) {
+        SQOA_FREE(images);
+    }
+    if (sizes) {
+        SQOA_FREE(sizes);
+    }
+    if (delta) {
+        SQOA_FREE(delta);
+    }
+    return bytes;
+}
+
+int sqoa_anim_info(const void *data, int size, sqoa_desc *desc) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned int frame_count;
+    int p = 0;
+
+    if (data == NULL || desc == NULL || size < SQAN_HEADER_SIZE) {
+        return 0;
+    }
+    if (sqoa_read_32(bytes, &p) != SQAN_MAGIC) {
+        return 0;
+    }
+
+    memset(desc, 0, sizeof(sqoa_desc));
+    desc->width = sqoa_read_32(bytes, &p);
+    desc->height = sqoa_read_32(bytes, &p);
+    desc->channels = bytes[p++];
+    desc->colorspace = bytes[p++];
+    frame_count = sqoa_read_32(bytes, &p);
+    if (
+        desc->width == 0 || desc->height == 0 ||
+        desc->channels < 1 || desc->channels > 6 ||
+        frame_count == 0 ||
+        frame_count > (unsigned int)(size - SQAN_HEADER_SIZE) / SQAN_FRAME_SIZE
+    ) {
+        return 0;
+    }
+    return frame_count;
+}
+
+int sqoa_anim_next(const void *data, int size, int frame, void *pixels, int channels) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned char *out = (unsigned char *)pixels, *image;
+    unsigned int offset, image_size;
+    sqoa_desc anim, desc;
+    int p, px_len, keyframe, i;
+
+    if (pixels == NULL || channels < 0 || channels > 4) {
+        return 0;
+    }
+    if (frame < 0 || frame >= sqoa_anim_info(data, size, &anim)) {
+        return 0;
+    }
+
+    p = SQAN_HEADER_SIZE + frame * SQAN_FRAME_SIZE;
+    offset = sqoa_read_32(bytes, &p);
+    image_size = sqoa_read_32(bytes, &p);
+    keyframe = bytes[p];
+    if (offset > (unsigned int)size || image_size > (unsigned int)size - offset) {
+        return 0;
+    }
+
+    if (channels == 0) {
+        channels = (anim.channels < 3 ? 1 : 3) + ((anim.channels & 1) == 0);
+    }
+    image = (unsigned char *) sqoa_decode(bytes + offset, image_size, &desc, channels);
+    if (!image) {
+        return 0;
+    }
+    if (desc.width != anim.width || desc.height != anim.height) {
+        SQOA_FREE(image);
+        return 0;
+    }
+
+    px_len = anim.width * anim.height * channels;
+    if (keyframe) {
+        memcpy(out, image, px_len);
+    }
+    else if ((channels & 1) == 0 && (anim.channels & 1) != 0) {
+        /* The decoder fills in the missing alpha, which is not a difference */
+        for (i = 0; i < px_len; i++) {
+            if (i % channels != channels - 1) {
+                out[i] += image[i];
+            }
+        }
+    }
+    else {
+        for (i = 0; i < px_len; i++) {
+            out[i] += image[i];
+        }
+    }
+
+    SQOA_FREE(image);
+    return 1;
+}
+
+void *sqoa_anim_decode(const void *data, int size, sqoa_desc *desc, int frame, int channels) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned char *pixels;
+    int frame_count, key;
+
+    if (desc == NULL || channels < 0 || channels > 4) {
+        return NULL;
+    }
+    frame_count = sqoa_anim_info(data, size, desc);
+    if (frame < 0 || frame >= frame_count) {
+        return NULL;
+    }
+
+    /* Seek back to the keyframe, the first frame is always one */
+    for (key = frame; key > 0; key--) {
+        if (bytes[SQAN_HEADER_SIZE + key * SQAN_FRAME_SIZE + 8]) {
+            break;
+        }
+    }
+    if (!bytes[SQAN_HEADER_SIZE + key * SQAN_FRAME_SIZE + 8]) {
+        return NULL;
+    }
+
+    if (channels == 0) {
+        channels = (desc->channels < 3 ? 1 : 3) + ((desc->channels & 1) == 0);
+    }
+    pixels = (unsigned char *) SQOA_MALLOC(desc->width * desc->height * channels);
+    if (!pixels) {
+        return NULL;
+    }
+    for (; key <= frame; key++) {
+        if (!sqoa_anim_next(data, size, key, pixels, channels)) {
+            SQOA_FREE(pixels);
+            return NULL;
+        }
+    }
+    return pixels;
+}
+
+#define SQBD_HEADER_SIZE 18
+#define SQBD_BAND_SIZE   8
+#define SQBD_MAGIC \
+    (((unsigned int)'S') << 24 | ((unsigned int)'q') << 16 | \
+     ((unsigned int)'b') <<  8 | ((unsigned int)'d'))
+
+/* Read the header of a banded image. Returns the number of bands, or 0 */
+static int sqoa_band_count(const unsigned char *bytes, int size, sqoa_desc *desc, unsigned int *band_height) {
+    unsigned int bands;
+    int p = 0;
+
+    if (bytes == NULL || size < SQBD_HEADER_SIZE || sqoa_read_32(bytes, &p) != SQBD_MAGIC) {
+        return 0;
+    }
+
+    memset(desc, 0, sizeof(sqoa_desc));
+    desc->width = sqoa_read_32(bytes, &p);
+    desc->height = sqoa_read_32(bytes, &p);
+    desc->channels = bytes[p++];
+    desc->colorspace = bytes[p++];
+    *band_height = sqoa_read_32(bytes, &p);
+    if (
+        desc->width == 0 || desc->height == 0 || *band_height == 0 ||
+        desc->channels < 1 || desc->channels > 6 ||
+        desc->height >= SQOA_PIXELS_MAX / desc->width
+    ) {
+        return 0;
+    }
+
+    /* The band index must fit in an int size */
+    bands = (desc->height - 1) / *band_height + 1;
+    if (bands > (0x7fffffff - SQBD_HEADER_SIZE) / SQBD_BAND_SIZE) {
+        return 0;
+    }
+    return bands;
+}
+
+/* Read the header of a banded image and check that the band index fits.
+Returns the number of bands, or 0 */
+static int sqoa_band_header(const unsigned char *bytes, int size, sqoa_desc *desc, unsigned int *band_height) {
+    int bands = sqoa_band_count(bytes, size, desc, band_height);
+
+    if (bands > (size - SQBD_HEADER_SIZE) / SQBD_BAND_SIZE) {
+        return 0;
+    }
+    return bands;
+}
+
+/* Write the banded image from the band images, each either in images or, if
+NULL there, copied from prev */
+static void *sqoa_band_write(
+    const sqoa_desc *desc, int band_height, int bands,
+    void **images, int *sizes, const unsigned char *prev, int *out_len
+) {
+    unsigned char *bytes;
+    int b, p = 0, offset, total;
+
+    /* The whole banded image must fit an int size */
+    if (bands > (0x7fffffff - SQBD_HEADER_SIZE) / SQBD_BAND_SIZE) {
+        return NULL;
+    }
+    total = SQBD_HEADER_SIZE + bands * SQBD_BAND_SIZE;
+    for (b = 0; b < bands; b++) {
+        if (sizes[b] > 0x7fffffff - total) {
+            return NULL;
+        }
+        total += sizes[b];
+    }
+    bytes = (unsigned char *) SQOA_MALLOC(total);
+    if (!bytes) {
+        return NULL;
+    }
+
+    sqoa_write_32(bytes, &p, SQBD_MAGIC);
+    sqoa_write_32(bytes, &p, desc->width);
+    sqoa_write_32(bytes, &p, desc->height);
+    bytes[p++] = desc->channels;
+    bytes[p++] = desc->colorspace;
+    sqoa_write_32(bytes, &p, band_height);
+
+    offset = SQBD_HEADER_SIZE + bands * SQBD_BAND_SIZE;
+    for (b = 0; b < bands; b++) {
+        if (images[b]) {
+            memcpy(bytes + offset, images[b], sizes[b]);
+        }
+        else {
+            int q = SQBD_HEADER_SIZE + b * SQBD_BAND_SIZE;
+            memcpy(bytes + offset, prev + sqoa_read_32(prev, &q), sizes[b]);
+        }
+        sqoa_write_32(bytes, &p, offset);
+        sqoa_write_32(bytes, &p, sizes[b]);
+        offset += sizes[b];
+    }
+
+    *out_len = total;
+    return bytes;
+}
+
+/* Encode the dirty bands of data into images, or all of them if dirty is
+NULL. Returns 0 if an encode failed */
+static int sqoa_band_images(
+    const void *data, const sqoa_desc *desc, int band_height, int bands,
+    const unsigned char *dirty, void **images, int *sizes
+) {
+    sqoa_desc band_desc = *desc;
+    size_t row_len = (size_t)desc->width *
+        ((desc->channels < 3 ? 1 : 3) + ((desc->channels & 1) == 0));
+    int b;
+
+    for (b = 0; b < bands; b++) {
+        size_t y = (size_t)b * band_height;
+        if (dirty && !dirty[b]) {
+            continue;
+        }
+        band_desc.height = desc->height - y < (unsigned int)band_height
+            ? desc->height - y
+            : (unsigned int)band_height;
+        images[b] = sqoa_encode(
+            (const unsigned char *)data + y * row_len, &band_desc, &sizes[b]
+        );
+        if (!images[b]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void *sqoa_band_encode(const void *data, const sqoa_desc *desc, int band_height, int *out_len) {
+    void **images;
+    int *sizes;
+    void *bytes = NULL;
+    int b, bands;
+
+    if (
+        data == NULL || desc == NULL || out_len == NULL ||
+        band_height < 1 || desc->width == 0 || desc->height == 0 ||
+        desc->height >= SQOA_PIXELS_MAX / desc->width
+    ) {
+        return NULL;
+    }
+
+    bands = (desc->height - 1) / band_height + 1;
+    images = (void **) SQOA_MALLOC(bands * sizeof(void *));
+    sizes = (int *) SQOA_MALLOC(bands * sizeof(int));
+    if (images && sizes) {
+        memset(images, 0, bands * sizeof(void *));
+        if (sqoa_band_images(data, desc, band_height, bands, NULL, images, sizes)) {
+            bytes = sqoa_band_write(desc, band_height, bands, images, sizes, NULL, out_len);
+        }
+        for (b = 0; b < bands; b++) {
+            if (images[b]) {
+                SQOA_FREE(images[b]);
+            }
+        }
+    }
+    if (images) {
+        SQOA_FREE(images);
+    }
+    if (sizes) {
+        SQOA_FREE(sizes);
+    }
+    return bytes;
+}
+
+void *sqoa_band_update(const void *prev, int prev_size, const void *data, const sqoa_desc *desc, const sqoa_rect *rects, int rect_count, int *out_len) {
+    const unsigned char *bytes = (const unsigned char *)prev;
+    unsigned char *dirty;
+    void **images;
+    int *sizes;
+    void *out = NULL;
+    sqoa_desc prev_desc;
+    unsigned int band_height;
+    int b, i, bands, ok;
+
+    if (
+        data == NULL || desc == NULL || out_len == NULL ||
+        (rects == NULL && rect_count > 0)
+    ) {
+        return NULL;
+    }
+    bands = sqoa_band_header(bytes, prev_size, &prev_desc, &band_height);
+    if (
+        !bands ||
+        prev_desc.width != desc->width || prev_desc.height != desc->height ||
+        prev_desc.channels != desc->channels
+    ) {
+        return NULL;
+    }
+
+    dirty = (unsigned char *) SQOA_MALLOC(bands);
+    images = (void **) SQOA_MALLOC(bands * sizeof(void *));
+    sizes = (int *) SQOA_MALLOC(bands * sizeof(int));
+    ok = dirty && images && sizes;
+    if (ok) {
+        memset(dirty, 0, bands);
+        memset(images, 0, bands * sizeof(void *));
+
+        for (i = 0; i < rect_count; i++) {
+            unsigned int top = rects[i].y, bottom;
+            if (rects[i].width == 0 || rects[i].height == 0 || top >= desc->height) {
+                continue;
+            }
+            bottom = desc->height - top < rects[i].height
+                ? desc->height - 1
+                : top + rects[i].height - 1;
+            for (b = top / band_height; b <= (int)(bottom / band_height); b++) {
+                dirty[b] = 1;
+            }
+        }
+
+        /* The bands that are kept must lie within prev */
+        for (b = 0; b < bands; b++) {
+            int q = SQBD_HEADER_SIZE + b * SQBD_BAND_SIZE;
+            unsigned int offset = sqoa_read_32(bytes, &q);
+            unsigned int size = sqoa_read_32(bytes, &q);
+            if (
+                !dirty[b] &&
+                (offset > (unsigned int)prev_size || size > (unsigned int)prev_size - offset)
+            ) {
+                ok = 0;
+            }
+            sizes[b] = size;
+        }
+    }
+
+    if (ok && sqoa_band_images(data, desc, band_height, bands, dirty, images, sizes)) {
+        out = sqoa_band_write(desc, band_height, bands, images, sizes, bytes, out_len);
+    }
+
+    if (images) {
+        for (b = 0; b < bands; b++) {
+            if (images[b]) {
+                SQOA_FREE(images[b]);
+            }
+        }
+        SQOA_FREE(images);
+    }
+    if (sizes) {
+        SQOA_FREE(sizes);
+    }
+    if (dirty) {
+        SQOA_FREE(dirty);
+    }
+    return out;
+}
+
+void *sqoa_band_decode(const void *data, int size, sqoa_desc *desc, int channels) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned char *pixels;
+    unsigned int band_height;
+    size_t row_len;
+    int b, bands;
+
+    if (desc == NULL || channels < 0 || channels > 4) {
+        return NULL;
+    }
+    bands = sqoa_band_header(bytes, size, desc, &band_height);
+    if (!bands) {
+        return NULL;
+    }
+
+    if (channels == 0) {
+        channels = (desc->channels < 3 ? 1 : 3) + ((desc->channels & 1) == 0);
+    }
+    row_len = (size_t)desc->width * channels;
+    pixels = (unsigned char *) SQOA_MALLOC(desc->height * row_len);
+    if (!pixels) {
+        return NULL;
+    }
+
+    for (b = 0; b < bands; b++) {
+        int q = SQBD_HEADER_SIZE + b * SQBD_BAND_SIZE;
+        unsigned int offset = sqoa_read_32(bytes, &q);
+        unsigned int band_size = sqoa_read_32(bytes, &q);
+        unsigned int y = b * band_height;
+        unsigned int rows = desc->height - y < band_height ? desc->height - y : band_height;
+        sqoa_desc band_desc;
+        void *band = NULL;
+
+        if (offset <= (unsigned int)size && band_size <= (unsigned int)size - offset) {
+            band = sqoa_decode(bytes + offset, band_size, &band_desc, channels);
         }
-        
-        if (add_alpha) {
-            pixels[px_pos + channels - 1] = px.rgba.a;
+        if (!band || band_desc.width != desc->width || band_desc.height != rows) {
+            if (band) {
+                SQOA_FREE(band);
+            }
+            SQOA_FREE(pixels);
+            return NULL;
         }
+        memcpy(pixels + (size_t)y * row_len, band, rows * row_len);
+        SQOA_FREE(band);
     }
-
     return pixels;
 }
 
+int sqoa_band_index(const void *data, int size, sqoa_desc *desc, sqoa_band *bands, int max_bands) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned int band_height;
+    int b, count;
+
+    if (desc == NULL || (bands != NULL && max_bands < 0)) {
+        return 0;
+    }
+    count = bands ?
+        sqoa_band_header(bytes, size, desc, &band_height) :
+        sqoa_band_count(bytes, size, desc, &band_height);
+    if (!count) {
+        return 0;
+    }
+
+    for (b = 0; bands && b < count && b < max_bands; b++) {
+        int q = SQBD_HEADER_SIZE + b * SQBD_BAND_SIZE;
+        unsigned int y = b * band_height;
+        bands[b].offset = sqoa_read_32(bytes, &q);
+        bands[b].size = sqoa_read_32(bytes, &q);
+        bands[b].y = y;
+        bands[b].height = desc->height - y < band_height ? desc->height - y : band_height;
+    }
+    return count;
+}
+
+int sqoa_band_subset(const void *data, int size, int first, int count, void *out, int out_size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned char *subset = (unsigned char *)out;
+    unsigned int band_height, height = 0, offset;
+    sqoa_desc desc;
+    int b, bands, p = 0;
+
+    bands = sqoa_band_header(bytes, size, &desc, &band_height);
+    if (
+        !bands || out == NULL || first < 0 || count < 1 ||
+        first >= bands || count > bands - first ||
+        out_size < SQBD_HEADER_SIZE + count * SQBD_BAND_SIZE
+    ) {
+        return 0;
+    }
+
+    /* Only the last band of the image may be short, the height of the subset
+    keeps the band height of the others */
+    for (b = first; b < first + count; b++) {
+        unsigned int y = b * band_height;
+        height += desc.height - y < band_height ? desc.height - y : band_height;
+    }
+
+    sqoa_write_32(subset, &p, SQBD_MAGIC);
+    sqoa_write_32(subset, &p, desc.width);
+    sqoa_write_32(subset, &p, height);
+    subset[p++] = desc.channels;
+    subset[p++] = desc.colorspace;
+    sqoa_write_32(subset, &p, band_height);
+
+    offset = SQBD_HEADER_SIZE + count * SQBD_BAND_SIZE;
+    for (b = first; b < first + count; b++) {
+        int q = SQBD_HEADER_SIZE + b * SQBD_BAND_SIZE + 4;
+        unsigned int band_size = sqoa_read_32(bytes, &q);
+        if (band_size > 0x7fffffff - offset) {
+            return 0;
+        }
+        sqoa_write_32(subset, &p, offset);
+        sqoa_write_32(subset, &p, band_size);
+        offset += band_size;
+    }
+    return p;
+}
+
 #ifndef SQOA_NO_STDIO
 #include <stdio.h>
 
@@ -865,5 +4359,749 @@ void *sqoa_read(const char *filename, sqoa_desc *desc, int channels) {
     return pixels;
 }
 
+int sqoa_read_info(const char *filename, sqoa_desc *desc) {
+    FILE *f = fopen(filename, "rb");
+    unsigned char header[SQOA_INFO_SIZE];
+    int bytes_read;
+
+    if (!f) {
+        return 0;
+    }
+
+    /* Unbuffered, so that only the header is read from the file */
+    setvbuf(f, NULL, _IONBF, 0);
+    bytes_read = fread(header, 1, sizeof(header), f);
+    fclose(f);
+
+    return sqoa_info(header, bytes_read, desc);
+}
+
 #endif /* SQOA_NO_STDIO */
+
+#ifdef SQOA_THREADS
+#include <pthread.h>
+#include <unistd.h>
+
+#define SQOA_BATCH_QUEUE 256
+
+struct sqoa_batch {
+    /* Bounded ring of submitted jobs, lock-free for any number of producers
+    and consumers. A slot is free for the producer that takes ticket t from
+    tail when its sequence is t, and holds a job for the consumer that takes
+    ticket t from head when its sequence is t + 1 */
+    sqoa_job *slots[SQOA_BATCH_QUEUE];
+    unsigned int seq[SQOA_BATCH_QUEUE];
+    unsigned int head, tail;
+
+    /* Finished jobs: a lock-free stack pushed by the workers, taken whole by
+    sqoa_batch_wait into ready */
+    sqoa_job *done, *ready;
+    int pending;
+
+    /* Threads only take the lock to sleep when they have nothing to do, and
+    are only signalled when some are sleeping */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond, done_cond;
+    int sleepers, waiting, stop;
+
+    pthread_t *threads;
+    int thread_count;
+};
+
+static int sqoa_batch_push(sqoa_batch *b, sqoa_job *job) {
+    unsigned int t = __atomic_load_n(&b->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        unsigned int *seq = &b->seq[t % SQOA_BATCH_QUEUE];
+        int dif = (int)(__atomic_load_n(seq, __ATOMIC_ACQUIRE) - t);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(
+                &b->tail, &t, t + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+            )) {
+                b->slots[t % SQOA_BATCH_QUEUE] = job;
+                __atomic_store_n(seq, t + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+        else if (dif < 0) {
+            return 0;
+        }
+        else {
+            t = __atomic_load_n(&b->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static sqoa_job *sqoa_batch_pop(sqoa_batch *b) {
+    unsigned int h = __atomic_load_n(&b->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        unsigned int *seq = &b->seq[h % SQOA_BATCH_QUEUE];
+        int dif = (int)(__atomic_load_n(seq, __ATOMIC_ACQUIRE) - (h + 1));
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(
+                &b->head, &h, h + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+            )) {
+                sqoa_job *job = b->slots[h % SQOA_BATCH_QUEUE];
+                __atomic_store_n(seq, h + SQOA_BATCH_QUEUE, __ATOMIC_RELEASE);
+                return job;
+            }
+        }
+        else if (dif < 0) {
+            return NULL;
+        }
+        else {
+            h = __atomic_load_n(&b->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Signal a sleeping thread after making work visible. The fence pairs with
+the one taken by the sleeper between counting itself and checking for work */
+static void sqoa_batch_wake(sqoa_batch *b, int *sleepers, pthread_cond_t *cond) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(sleepers, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&b->lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+static void sqoa_batch_run(sqoa_batch *b, sqoa_job *job) {
+    job->encoded_len = 0;
+    job->encoded = sqoa_encode(job->data, &job->desc, &job->encoded_len);
+
+    job->next = __atomic_load_n(&b->done, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+        &b->done, &job->next, job, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+    ));
+    sqoa_batch_wake(b, &b->waiting, &b->done_cond);
+}
+
+static void *sqoa_batch_worker(void *arg) {
+    sqoa_batch *b = (sqoa_batch *)arg;
+
+    for (;;) {
+        sqoa_job *job = sqoa_batch_pop(b);
+        if (!job) {
+            pthread_mutex_lock(&b->lock);
+            __atomic_add_fetch(&b->sleepers, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            while (!(job = sqoa_batch_pop(b)) && !b->stop) {
+                pthread_cond_wait(&b->work_cond, &b->lock);
+            }
+            __atomic_sub_fetch(&b->sleepers, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&b->lock);
+            if (!job) {
+                return NULL;
+            }
+        }
+        sqoa_batch_run(b, job);
+    }
+}
+
+sqoa_batch *sqoa_batch_create(int threads) {
+    sqoa_batch *b;
+    int i;
+
+    if (threads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int)online : 1;
+    }
+
+    b = (sqoa_batch *) SQOA_MALLOC(sizeof(sqoa_batch));
+    if (!b) {
+        return NULL;
+    }
+    memset(b, 0, sizeof(sqoa_batch));
+    b->threads = (pthread_t *) SQOA_MALLOC(threads * sizeof(pthread_t));
+    if (!b->threads) {
+        SQOA_FREE(b);
+        return NULL;
+    }
+    for (i = 0; i < SQOA_BATCH_QUEUE; i++) {
+        b->seq[i] = i;
+    }
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->work_cond, NULL);
+    pthread_cond_init(&b->done_cond, NULL);
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&b->threads[i], NULL, sqoa_batch_worker, b) != 0) {
+            break;
+        }
+    }
+    b->thread_count = i;
+    if (b->thread_count == 0) {
+        sqoa_batch_destroy(b);
+        return NULL;
+    }
+    return b;
+}
+
+int sqoa_batch_submit(sqoa_batch *batch, sqoa_job *job) {
+    if (batch == NULL || job == NULL) {
+        return 0;
+    }
+
+    __atomic_add_fetch(&batch->pending, 1, __ATOMIC_RELAXED);
+    if (sqoa_batch_push(batch, job)) {
+        sqoa_batch_wake(batch, &batch->sleepers, &batch->work_cond);
+    }
+    else {
+        /* The queue is full: rather than block, do the work here */
+        sqoa_batch_run(batch, job);
+    }
+    return 1;
+}
+
+sqoa_job *sqoa_batch_wait(sqoa_batch *batch) {
+    sqoa_job *job;
+
+    if (batch == NULL || __atomic_load_n(&batch->pending, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+
+    if (!batch->ready) {
+        batch->ready = __atomic_exchange_n(&batch->done, NULL, __ATOMIC_ACQUIRE);
+    }
+    if (!batch->ready) {
+        pthread_mutex_lock(&batch->lock);
+        __atomic_store_n(&batch->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (!(batch->ready = __atomic_exchange_n(&batch->done, NULL, __ATOMIC_ACQUIRE))) {
+            pthread_cond_wait(&batch->done_cond, &batch->lock);
+        }
+        __atomic_store_n(&batch->waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    job = batch->ready;
+    batch->ready = job->next;
+    __atomic_sub_fetch(&batch->pending, 1, __ATOMIC_RELAXED);
+    return job;
+}
+
+void sqoa_batch_destroy(sqoa_batch *batch) {
+    sqoa_job *job;
+    int i;
+
+    if (batch == NULL) {
+        return;
+    }
+
+    /* The workers empty the queue before they see stop */
+    pthread_mutex_lock(&batch->lock);
+    batch->stop = 1;
+    pthread_cond_broadcast(&batch->work_cond);
+    pthread_mutex_unlock(&batch->lock);
+    for (i = 0; i < batch->thread_count; i++) {
+        pthread_join(batch->threads[i], NULL);
+    }
+
+    while ((job = sqoa_batch_wait(batch))) {
+        if (job->encoded) {
+            SQOA_FREE(job->encoded);
+            job->encoded = NULL;
+        }
+    }
+
+    pthread_cond_destroy(&batch->done_cond);
+    pthread_cond_destroy(&batch->work_cond);
+    pthread_mutex_destroy(&batch->lock);
+    SQOA_FREE(batch->threads);
+    SQOA_FREE(batch);
+}
+
+#include <fcntl.h>
+#if defined(SQOA_IO_URING) && defined(__linux__)
+    #include <errno.h>
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #define SQOA_URING_SUPPORTED
+#endif
+
+#define SQOA_WRITER_DEPTH 64
+
+typedef struct sqoa_write_req {
+    struct sqoa_write_req *next;
+    void *data;
+    int size;
+    int slot;
+    int completions;
+    int failed;
+    char filename[1];
+} sqoa_write_req;
+
+struct sqoa_writer {
+    int depth;
+    int failed;
+
+    /* Thread backend: the thread takes the whole list of queued files at
+    once and writes them one after the other */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond, idle_cond;
+    sqoa_write_req *head, *tail;
+    int queued, busy, stop, has_thread;
+    pthread_t thread;
+
+#ifdef SQOA_URING_SUPPORTED
+    /* io_uring backend, used when ring_fd >= 0: each file is a chain of
+    OPENAT into a registered file slot, WRITE and CLOSE, and is done when the
+    three completions are in */
+    int ring_fd;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    sqoa_write_req **slots;
+    int in_flight, unsubmitted;
+#endif
+};
+
+static int sqoa_write_file(const char *filename, const void *data, int size) {
+    const char *bytes = (const char *)data;
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int ok = fd >= 0;
+
+    while (ok && size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        ok = written > 0;
+        bytes += written;
+        size -= written;
+    }
+    if (fd >= 0 && close(fd) != 0) {
+        ok = 0;
+    }
+    return ok;
+}
+
+static void *sqoa_writer_thread(void *arg) {
+    sqoa_writer *w = (sqoa_writer *)arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        sqoa_write_req *req;
+        int failed = 0;
+
+        while (!w->head && !w->stop) {
+            pthread_cond_wait(&w->work_cond, &w->lock);
+        }
+        if (!w->head) {
+            break;
+        }
+        req = w->head;
+        w->head = w->tail = NULL;
+        w->queued = 0;
+        w->busy = 1;
+        pthread_cond_broadcast(&w->idle_cond);
+        pthread_mutex_unlock(&w->lock);
+
+        while (req) {
+            sqoa_write_req *next = req->next;
+            failed += !sqoa_write_file(req->filename, req->data, req->size);
+            SQOA_FREE(req->data);
+            SQOA_FREE(req);
+            req = next;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->failed += failed;
+        w->busy = 0;
+        pthread_cond_broadcast(&w->idle_cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+#ifdef SQOA_URING_SUPPORTED
+
+/* Submit the new entries and wait for a completion if wait is set. A signal
+during the wait is not an error */
+static int sqoa_uring_enter(sqoa_writer *w, int wait) {
+    int ret;
+    do {
+        ret = syscall(
+            __NR_io_uring_enter, w->ring_fd, w->unsubmitted, wait,
+            wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0
+        );
+    } while (ret < 0 && errno == EINTR);
+    if (ret >= 0) {
+        w->unsubmitted -= ret;
+    }
+    return ret;
+}
+
+static void sqoa_uring_reap(sqoa_writer *w) {
+    unsigned int head = *w->cq_head;
+    unsigned int tail = __atomic_load_n(w->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &w->cqes[head & *w->cq_mask];
+        sqoa_write_req *req = (sqoa_write_req *)(size_t)(cqe->user_data & ~(__u64)3);
+        int step = (int)(cqe->user_data & 3);
+
+        /* Step 1 is the write, which must write all the data */
+        if (cqe->res < 0 || (step == 1 && cqe->res != req->size)) {
+            req->failed = 1;
+        }
+        if (++req->completions == 3) {
+            w->failed += req->failed;
+            w->slots[req->slot] = NULL;
+            w->in_flight--;
+            SQOA_FREE(req->data);
+            SQOA_FREE(req);
+        }
+    }
+    __atomic_store_n(w->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_sqe *sqoa_uring_sqe(sqoa_writer *w, sqoa_write_req *req, int step, int op) {
+    unsigned int tail = *w->sq_tail;
+    unsigned int index = tail & *w->sq_mask;
+    struct io_uring_sqe *sqe = &w->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->user_data = (__u64)(size_t)req | step;
+    w->sq_array[index] = index;
+    __atomic_store_n(w->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    w->unsubmitted++;
+    return sqe;
+}
+
+static int sqoa_uring_write(sqoa_writer *w, sqoa_write_req *req) {
+    struct io_uring_sqe *sqe;
+    int slot;
+
+    sqoa_uring_reap(w);
+    while (w->in_flight == w->depth) {
+        if (sqoa_uring_enter(w, 1) < 0) {
+            return 0;
+        }
+        sqoa_uring_reap(w);
+    }
+    for (slot = 0; w->slots[slot]; slot++);
+    w->slots[slot] = req;
+    req->slot = slot;
+    w->in_flight++;
+
+    sqe = sqoa_uring_sqe(w, req, 0, IORING_OP_OPENAT);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (__u64)(size_t)req->filename;
+    sqe->len = 0666;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->file_index = slot + 1;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = sqoa_uring_sqe(w, req, 1, IORING_OP_WRITE);
+    sqe->fd = slot;
+    sqe->addr = (__u64)(size_t)req->data;
+    sqe->len = req->size;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+    sqe = sqoa_uring_sqe(w, req, 2, IORING_OP_CLOSE);
+    sqe->file_index = slot + 1;
+
+    /* Submit in batches of a quarter of the depth */
+    if (w->unsubmitted >= 3 * (w->depth / 4 + 1)) {
+        sqoa_uring_enter(w, 0);
+    }
+    return 1;
+}
+
+static void sqoa_uring_close(sqoa_writer *w) {
+    if (w->sqes) {
+        munmap(w->sqes, w->sqes_size);
+    }
+    if (w->cq_ring && w->cq_ring != w->sq_ring) {
+        munmap(w->cq_ring, w->cq_ring_size);
+    }
+    if (w->sq_ring) {
+        munmap(w->sq_ring, w->sq_ring_size);
+    }
+    if (w->slots) {
+        SQOA_FREE(w->slots);
+    }
+    close(w->ring_fd);
+    w->ring_fd = -1;
+}
+
+/* OPENAT and CLOSE into a registered file slot need Linux 5.15: older kernels
+ignore the slot, leak the file and close the fd the slot number stands for.
+The opcodes alone do not tell, but IORING_OP_LINKAT came with the same
+release, so the ring is only used when it is supported. */
+static int sqoa_uring_probe(sqoa_writer *w) {
+    static const int ops[] = {
+        IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_LINKAT
+    };
+    struct io_uring_probe *probe;
+    int i, ok;
+
+    probe = (struct io_uring_probe *) SQOA_MALLOC(
+        sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)
+    );
+    if (!probe) {
+        return 0;
+    }
+    memset(probe, 0, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    ok = syscall(__NR_io_uring_register, w->ring_fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    for (i = 0; ok && i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    SQOA_FREE(probe);
+    return ok;
+}
+
+static int sqoa_uring_open(sqoa_writer *w) {
+    struct io_uring_params params;
+    int *files, i, ret;
+
+    memset(&params, 0, sizeof(params));
+    w->ring_fd = syscall(__NR_io_uring_setup, 3 * w->depth, &params);
+    if (w->ring_fd < 0) {
+        return 0;
+    }
+    if (!sqoa_uring_probe(w)) {
+        sqoa_uring_close(w);
+        return 0;
+    }
+
+    w->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    w->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (w->cq_ring_size > w->sq_ring_size) {
+            w->sq_ring_size = w->cq_ring_size;
+        }
+        w->cq_ring_size = w->sq_ring_size;
+    }
+    w->sq_ring = mmap(
+        NULL, w->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        w->ring_fd, IORING_OFF_SQ_RING
+    );
+    if (w->sq_ring == MAP_FAILED) {
+        w->sq_ring = NULL;
+        sqoa_uring_close(w);
+        return 0;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        w->cq_ring = w->sq_ring;
+    }
+    else {
+        w->cq_ring = mmap(
+            NULL, w->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            w->ring_fd, IORING_OFF_CQ_RING
+        );
+        if (w->cq_ring == MAP_FAILED) {
+            w->cq_ring = NULL;
+            sqoa_uring_close(w);
+            return 0;
+        }
+    }
+    w->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    w->sqes = (struct io_uring_sqe *) mmap(
+        NULL, w->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        w->ring_fd, IORING_OFF_SQES
+    );
+    if (w->sqes == MAP_FAILED) {
+        w->sqes = NULL;
+        sqoa_uring_close(w);
+        return 0;
+    }
+
+    w->sq_head  = (unsigned int *)((char *)w->sq_ring + params.sq_off.head);
+    w->sq_tail  = (unsigned int *)((char *)w->sq_ring + params.sq_off.tail);
+    w->sq_mask  = (unsigned int *)((char *)w->sq_ring + params.sq_off.ring_mask);
+    w->sq_array = (unsigned int *)((char *)w->sq_ring + params.sq_off.array);
+    w->cq_head  = (unsigned int *)((char *)w->cq_ring + params.cq_off.head);
+    w->cq_tail  = (unsigned int *)((char *)w->cq_ring + params.cq_off.tail);
+    w->cq_mask  = (unsigned int *)((char *)w->cq_ring + params.cq_off.ring_mask);
+    w->cqes = (struct io_uring_cqe *)((char *)w->cq_ring + params.cq_off.cqes);
+
+    /* One empty registered file slot per file in flight */
+    w->slots = (sqoa_write_req **) SQOA_MALLOC(w->depth * sizeof(sqoa_write_req *));
+    files = (int *) SQOA_MALLOC(w->depth * sizeof(int));
+    if (!w->slots || !files) {
+        if (files) {
+            SQOA_FREE(files);
+        }
+        sqoa_uring_close(w);
+        return 0;
+    }
+    for (i = 0; i < w->depth; i++) {
+        w->slots[i] = NULL;
+        files[i] = -1;
+    }
+    ret = syscall(__NR_io_uring_register, w->ring_fd, IORING_REGISTER_FILES, files, w->depth);
+    SQOA_FREE(files);
+    if (ret < 0) {
+        sqoa_uring_close(w);
+        return 0;
+    }
+    return 1;
+}
+
+#endif /* SQOA_URING_SUPPORTED */
+
+sqoa_writer *sqoa_writer_create(int depth) {
+    sqoa_writer *w = (sqoa_writer *) SQOA_MALLOC(sizeof(sqoa_writer));
+
+    if (!w) {
+        return NULL;
+    }
+    memset(w, 0, sizeof(sqoa_writer));
+    w->depth = depth > 0 ? depth : SQOA_WRITER_DEPTH;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work_cond, NULL);
+    pthread_cond_init(&w->idle_cond, NULL);
+
+#ifdef SQOA_URING_SUPPORTED
+    if (sqoa_uring_open(w)) {
+        return w;
+    }
+#endif
+
+    if (pthread_create(&w->thread, NULL, sqoa_writer_thread, w) != 0) {
+        sqoa_writer_destroy(w);
+        return NULL;
+    }
+    w->has_thread = 1;
+    return w;
+}
+
+int sqoa_writer_write(sqoa_writer *writer, const char *filename, void *data, int size) {
+    sqoa_write_req *req;
+    int name_len;
+
+    if (writer == NULL || filename == NULL || data == NULL) {
+        if (data) {
+            SQOA_FREE(data);
+        }
+        return 0;
+    }
+
+    name_len = strlen(filename);
+    req = (sqoa_write_req *) SQOA_MALLOC(sizeof(sqoa_write_req) + name_len);
+    if (!req) {
+        SQOA_FREE(data);
+        return 0;
+    }
+    memset(req, 0, sizeof(sqoa_write_req));
+    memcpy(req->filename, filename, name_len + 1);
+    req->data = data;
+    req->size = size;
+
+#ifdef SQOA_URING_SUPPORTED
+    if (writer->ring_fd >= 0) {
+        if (!sqoa_uring_write(writer, req)) {
+            SQOA_FREE(req->data);
+            SQOA_FREE(req);
+            return 0;
+        }
+        return 1;
+    }
+#endif
+
+    /* Block while depth files are already waiting for the thread */
+    pthread_mutex_lock(&writer->lock);
+    while (writer->queued >= writer->depth) {
+        pthread_cond_wait(&writer->idle_cond, &writer->lock);
+    }
+    if (writer->tail) {
+        writer->tail->next = req;
+    }
+    else {
+        writer->head = req;
+    }
+    writer->tail = req;
+    writer->queued++;
+    pthread_cond_signal(&writer->work_cond);
+    pthread_mutex_unlock(&writer->lock);
+    return 1;
+}
+
+int sqoa_writer_encode(sqoa_writer *writer, const char *filename, const void *data, const sqoa_desc *desc) {
+    int size;
+    void *encoded;
+
+    if (writer == NULL || filename == NULL) {
+        return 0;
+    }
+    encoded = sqoa_encode(data, desc, &size);
+    if (!encoded) {
+        return 0;
+    }
+    return sqoa_writer_write(writer, filename, encoded, size);
+}
+
+int sqoa_writer_flush(sqoa_writer *writer) {
+    int failed;
+
+    if (writer == NULL) {
+        return -1;
+    }
+
+#ifdef SQOA_URING_SUPPORTED
+    if (writer->ring_fd >= 0) {
+        /* If the ring fails, the files still in flight count as failed but
+        stay with the kernel */
+        while (writer->in_flight > 0) {
+            if (sqoa_uring_enter(writer, 1) < 0) {
+                break;
+            }
+            sqoa_uring_reap(writer);
+        }
+        failed = writer->failed + writer->in_flight;
+        writer->failed = 0;
+        return failed;
+    }
+#endif
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->head || writer->busy) {
+        pthread_cond_wait(&writer->idle_cond, &writer->lock);
+    }
+    failed = writer->failed;
+    writer->failed = 0;
+    pthread_mutex_unlock(&writer->lock);
+    return failed;
+}
+
+void sqoa_writer_destroy(sqoa_writer *writer) {
+    if (writer == NULL) {
+        return;
+    }
+
+#ifdef SQOA_URING_SUPPORTED
+    if (writer->ring_fd >= 0) {
+        /* The ring and the data of files still in flight may yet be used by
+        the kernel: they are left alone */
+        sqoa_writer_flush(writer);
+        if (writer->in_flight == 0) {
+            sqoa_uring_close(writer);
+        }
+        else if (writer->slots) {
+            SQOA_FREE(writer->slots);
+        }
+    }
+#endif
+
+    if (writer->has_thread) {
+        pthread_mutex_lock(&writer->lock);
+        writer->stop = 1;
+        pthread_cond_signal(&writer->work_cond);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+    }
+
+    pthread_cond_destroy(&writer->idle_cond);
+    pthread_cond_destroy(&writer->work_cond);
+    pthread_mutex_destroy(&writer->lock);
+    SQOA_FREE(writer);
+}
+
+#endif /* SQOA_THREADS */
 #endif /* SQOA_IMPLEMENTATION */
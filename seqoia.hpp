@@ -0,0 +1,534 @@
+/*
+
+Copyright (c) 2021, Dominic Szablewski - https://phoboslab.org
+SPDX-License-Identifier: MIT
+Modified by: Denis Bredelet (2023)
+
+seqoia.hpp - C++17 interface to seqoia.h
+
+-- About
+
+Owning, move-only buffers allocated from a std::pmr::memory_resource, and
+spans for the pixels and bytes given to the library. The C functions write the
+decoded pixels and the encoded bytes straight into the memory of the buffers:
+going through these classes costs no allocation or copy over the C API.
+
+-- Synopsis
+
+// Define `SQOA_IMPLEMENTATION` in *one* C/C++ file before including seqoia.h
+// to create the implementation. This header only has inline functions.
+
+#include "seqoia.hpp"
+
+// Decode a SQOA or QOI image into RGBA pixels allocated from a memory resource.
+// The image holds the description from the file header.
+std::pmr::monotonic_buffer_resource arena;
+sqoa::decoder decoder(&arena);
+sqoa::image image = decoder.decode(encoded_bytes, 4);
+
+// Encode RGBA pixels into a SQOA image, the encoded bytes are in a buffer.
+sqoa::buffer encoded = sqoa::encode(image.pixels(), sqoa_desc{
+    image.width(), image.height(), 4, SQOA_SRGB
+});
+
+// Encode an image given a few rows at a time, passing the encoded bytes to a
+// callable that returns false on failure.
+auto write = [&](sqoa::bytes data) { return out.write(data.data(), data.size()); };
+sqoa::encoder encoder(desc, write);
+encoder.rows(first_rows);
+encoder.rows(next_rows);
+std::size_t size = encoder.finish();
+
+// Decode an image row by row as its bytes arrive, for example in a coroutine
+// reading from a socket. feed and row never wait for more bytes.
+sqoa::row_decoder rows(4);
+unsigned char chunk[4096];
+while (std::size_t n = co_await socket.async_read_some(asio::buffer(chunk), token)) {
+    rows.feed(sqoa::bytes(chunk, n), [&](sqoa::bytes row) { send(row); });
+}
+rows.finish();
+
+Failures are reported with exceptions of type sqoa::error.
+
+With C++20, sqoa::span is std::span. With C++17, it is a minimal span that can
+be made from a pointer and a size or from a contiguous container.
+
+*/
+
+
+#ifndef SQOA_HPP
+#define SQOA_HPP
+
+#include "seqoia.h"
+
+#include <climits>
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 202002L && defined(__has_include)
+    #if __has_include(<span>)
+        #include <span>
+    #endif
+#endif
+
+namespace sqoa {
+
+#ifdef __cpp_lib_span
+template <class T>
+using span = std::span<T>;
+#else
+/* A view of size elements of T, the part of std::span used here */
+template <class T>
+class span {
+public:
+    constexpr span() noexcept : data_(nullptr), size_(0) {}
+    constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+    template <
+        class Container,
+        class = std::enable_if_t<
+            std::is_convertible_v<decltype(std::declval<Container &>().data()), T *>
+        >
+    >
+    constexpr span(Container &container) noexcept :
+        data_(container.data()), size_(container.size()) {}
+
+    template <class U, class = std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(const span<U> &other) noexcept : data_(other.data()), size_(other.size()) {}
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T *begin() const noexcept { return data_; }
+    constexpr T *end() const noexcept { return data_ + size_; }
+    constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+    constexpr span subspan(std::size_t offset, std::size_t count) const noexcept {
+        return span(data_ + offset, count);
+    }
+
+private:
+    T *data_;
+    std::size_t size_;
+};
+#endif
+
+/* A view of encoded bytes or raw pixels */
+using bytes = span<const unsigned char>;
+
+
+/* The exception thrown when a function of seqoia.h fails */
+class error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+
+namespace detail {
+
+inline int to_int(std::size_t size) {
+    if (size > INT_MAX) {
+        throw error("sqoa: more than INT_MAX bytes");
+    }
+    return static_cast<int>(size);
+}
+
+/* The number of channels of the pixels for a description, as sqoa_encode
+reads them and sqoa_decode returns them when channels is 0 */
+inline int pixel_channels(const sqoa_desc &desc) noexcept {
+    return (desc.channels < 3 ? 1 : 3) + ((desc.channels & 1) == 0);
+}
+
+template <class Write>
+int write(void *user, const void *data, int size) {
+    try {
+        return (*static_cast<Write *>(user))(bytes(static_cast<const unsigned char *>(data), size)) ? 1 : 0;
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+} // namespace detail
+
+
+/* Bytes allocated from a std::pmr::memory_resource and returned to it when
+the buffer is destroyed. A buffer has a capacity, fixed when it is created,
+and a size up to that capacity. It can be moved but not copied. */
+class buffer {
+public:
+    buffer() noexcept = default;
+
+    explicit buffer(
+        std::size_t capacity,
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource()
+    ) :
+        resource_(resource),
+        data_(static_cast<unsigned char *>(resource->allocate(capacity, alignof(std::max_align_t)))),
+        size_(capacity),
+        capacity_(capacity) {}
+
+    buffer(buffer &&other) noexcept :
+        resource_(std::exchange(other.resource_, nullptr)),
+        data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0)),
+        capacity_(std::exchange(other.capacity_, 0)) {}
+
+    buffer &operator=(buffer &&other) noexcept {
+        if (this != &other) {
+            reset();
+            resource_ = std::exchange(other.resource_, nullptr);
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            capacity_ = std::exchange(other.capacity_, 0);
+        }
+        return *this;
+    }
+
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    ~buffer() { reset(); }
+
+    /* Return the memory to the resource, the buffer is then empty */
+    void reset() noexcept {
+        if (data_) {
+            resource_->deallocate(data_, capacity_, alignof(std::max_align_t));
+        }
+        data_ = nullptr;
+        size_ = capacity_ = 0;
+    }
+
+    /* Change the size within the capacity. The memory is kept as it is */
+    void resize(std::size_t size) {
+        if (size > capacity_) {
+            throw error("sqoa: buffer resized beyond its capacity");
+        }
+        size_ = size;
+    }
+
+    unsigned char *data() noexcept { return data_; }
+    const unsigned char *data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    std::size_t capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return size_ == 0; }
+    unsigned char *begin() noexcept { return data_; }
+    unsigned char *end() noexcept { return data_ + size_; }
+    const unsigned char *begin() const noexcept { return data_; }
+    const unsigned char *end() const noexcept { return data_ + size_; }
+    std::pmr::memory_resource *resource() const noexcept { return resource_; }
+
+private:
+    std::pmr::memory_resource *resource_ = nullptr;
+    unsigned char *data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = 0;
+};
+
+
+/* Decoded pixels, width * height pixels of channels bytes, with the
+description from the header of the image they were decoded from */
+class image {
+public:
+    image() noexcept = default;
+    image(const sqoa_desc &desc, int channels, buffer pixels) noexcept :
+        desc_(desc), channels_(channels), pixels_(std::move(pixels)) {}
+
+    unsigned int width() const noexcept { return desc_.width; }
+    unsigned int height() const noexcept { return desc_.height; }
+
+    /* The channels of the pixels, that may differ from desc().channels */
+    int channels() const noexcept { return channels_; }
+    const sqoa_desc &desc() const noexcept { return desc_; }
+
+    span<unsigned char> pixels() noexcept { return pixels_; }
+    bytes pixels() const noexcept { return pixels_; }
+
+    /* Take the pixel buffer out of the image */
+    buffer release() noexcept { return std::move(pixels_); }
+
+private:
+    sqoa_desc desc_ = {};
+    int channels_ = 0;
+    buffer pixels_;
+};
+
+
+/* Read the description of a SQOA or QOI image from its header, that may be
+the first SQOA_INFO_SIZE bytes of the image */
+inline sqoa_desc info(bytes data) {
+    sqoa_desc desc;
+    if (!sqoa_info(data.data(), detail::to_int(data.size()), &desc)) {
+        throw error("sqoa: invalid header");
+    }
+    return desc;
+}
+
+/* Check a SQOA or QOI image as sqoa_validate does */
+inline bool validate(bytes data) {
+    sqoa_desc desc;
+    return data.size() <= INT_MAX && sqoa_validate(data.data(), static_cast<int>(data.size()), &desc);
+}
+
+
+/* Decodes SQOA and QOI images into pixels allocated from a memory resource */
+class decoder {
+public:
+    explicit decoder(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) noexcept :
+        resource_(resource) {}
+
+    std::pmr::memory_resource *resource() const noexcept { return resource_; }
+
+    /* Decode an image to channels, chosen as for sqoa_decode */
+    image decode(bytes data, int channels = 0) const {
+        sqoa_desc desc = info(data);
+        if (channels < 0 || channels > 4) {
+            throw error("sqoa: invalid channels");
+        }
+        if (channels == 0) {
+            channels = detail::pixel_channels(desc);
+        }
+        buffer pixels(std::size_t(desc.width) * desc.height * channels, resource_);
+        decode_into(data, pixels, channels);
+        return image(desc, channels, std::move(pixels));
+    }
+
+    /* Decode an image to channels into pixels, which must hold width * height
+    * channels bytes. Returns the description from the header */
+    static sqoa_desc decode_into(bytes data, span<unsigned char> pixels, int channels = 0) {
+        sqoa_desc desc;
+        if (!sqoa_decode_into(
+            data.data(), detail::to_int(data.size()), &desc, channels,
+            pixels.data(), detail::to_int(pixels.size())
+        )) {
+            throw error("sqoa: decoding failed");
+        }
+        return desc;
+    }
+
+private:
+    std::pmr::memory_resource *resource_;
+};
+
+
+/* Return the largest size of an image encoded with this description */
+inline std::size_t encode_bound(const sqoa_desc &desc) {
+    int bound = sqoa_encode_bound(&desc);
+    if (!bound) {
+        throw error("sqoa: invalid description");
+    }
+    return static_cast<std::size_t>(bound);
+}
+
+/* Encode pixels, as for sqoa_encode, into out, which must hold at least
+encode_bound(desc) bytes. Returns the size of the encoded image */
+inline std::size_t encode_into(bytes pixels, const sqoa_desc &desc, span<unsigned char> out) {
+    if (pixels.size() < std::size_t(desc.width) * desc.height * detail::pixel_channels(desc)) {
+        throw error("sqoa: not enough pixels");
+    }
+    int size = sqoa_encode_into(pixels.data(), &desc, out.data(), detail::to_int(out.size()));
+    if (!size) {
+        throw error("sqoa: encoding failed");
+    }
+    return static_cast<std::size_t>(size);
+}
+
+/* Encode pixels, as for sqoa_encode, into a buffer allocated from resource.
+The capacity of the buffer is encode_bound(desc), its size that of the
+encoded image */
+inline buffer encode(
+    bytes pixels, const sqoa_desc &desc,
+    std::pmr::memory_resource *resource = std::pmr::get_default_resource()
+) {
+    buffer out(encode_bound(desc), resource);
+    out.resize(encode_into(pixels, desc, out));
+    return out;
+}
+
+
+/* A streaming encoder, given the pixels a few rows at a time. The encoded
+bytes are passed to a callable taking sqoa::bytes and returning false on
+failure, which must outlive the encoder. If the callable throws, the encoder
+fails. The encoder can be moved but not copied. */
+class encoder {
+public:
+    encoder() noexcept = default;
+
+    template <class Write>
+    encoder(const sqoa_desc &desc, Write &write) :
+        encoder_(sqoa_encoder_create(&desc, &detail::write<Write>, &write)),
+        stride_(std::size_t(desc.width) * detail::pixel_channels(desc)) {
+        if (!encoder_) {
+            throw error("sqoa: invalid description");
+        }
+    }
+
+    encoder(encoder &&other) noexcept :
+        encoder_(std::exchange(other.encoder_, nullptr)),
+        stride_(other.stride_) {}
+
+    encoder &operator=(encoder &&other) noexcept {
+        if (this != &other) {
+            if (encoder_) {
+                sqoa_encoder_finish(encoder_);
+            }
+            encoder_ = std::exchange(other.encoder_, nullptr);
+            stride_ = other.stride_;
+        }
+        return *this;
+    }
+
+    encoder(const encoder &) = delete;
+    encoder &operator=(const encoder &) = delete;
+
+    /* An encoder that is not finished writes what it has, like finish */
+    ~encoder() {
+        if (encoder_) {
+            sqoa_encoder_finish(encoder_);
+        }
+    }
+
+    /* Encode the next rows, a whole number of rows of pixels */
+    void rows(bytes pixels) {
+        if (!encoder_ || stride_ == 0 || pixels.size() % stride_ != 0) {
+            throw error("sqoa: not a whole number of rows");
+        }
+        if (!sqoa_encoder_rows(encoder_, pixels.data(), detail::to_int(pixels.size() / stride_))) {
+            throw error("sqoa: encoding failed");
+        }
+    }
+
+    /* Write the end of the image. Returns the total size of the encoded
+    image */
+    std::size_t finish() {
+        if (!encoder_) {
+            throw error("sqoa: encoder already finished");
+        }
+        int size = sqoa_encoder_finish(std::exchange(encoder_, nullptr));
+        if (!size) {
+            throw error("sqoa: encoding failed");
+        }
+        return static_cast<std::size_t>(size);
+    }
+
+private:
+    sqoa_encoder *encoder_ = nullptr;
+    std::size_t stride_ = 0;
+};
+
+
+/* An incremental decoder, given the encoded bytes in pieces as they arrive
+and returning each row of pixels as soon as it is decoded. The rows are
+decoded to channels, chosen as for sqoa_decode. An invalid chunk makes the
+next feed or finish throw. The decoder can be moved but not copied. */
+class row_decoder {
+public:
+    explicit row_decoder(int channels = 0) :
+        decoder_(sqoa_decoder_create(channels)),
+        channels_(channels) {
+        if (!decoder_) {
+            throw error("sqoa: invalid channels");
+        }
+    }
+
+    row_decoder(row_decoder &&other) noexcept :
+        decoder_(std::exchange(other.decoder_, nullptr)),
+        channels_(other.channels_),
+        stride_(other.stride_) {}
+
+    row_decoder &operator=(row_decoder &&other) noexcept {
+        if (this != &other) {
+            if (decoder_) {
+                sqoa_decoder_finish(decoder_);
+            }
+            decoder_ = std::exchange(other.decoder_, nullptr);
+            channels_ = other.channels_;
+            stride_ = other.stride_;
+        }
+        return *this;
+    }
+
+    row_decoder(const row_decoder &) = delete;
+    row_decoder &operator=(const row_decoder &) = delete;
+
+    ~row_decoder() {
+        if (decoder_) {
+            sqoa_decoder_finish(decoder_);
+        }
+    }
+
+    /* Give the next bytes of the image */
+    void feed(bytes data) {
+        if (!decoder_ || !sqoa_decoder_feed(decoder_, data.data(), detail::to_int(data.size()))) {
+            throw error("sqoa: decoding failed");
+        }
+    }
+
+    /* Give the next bytes of the image and pass each row they complete to
+    on_row, a callable taking sqoa::bytes */
+    template <class OnRow>
+    void feed(bytes data, OnRow &&on_row) {
+        feed(data);
+        for (bytes line = row(); !line.empty(); line = row()) {
+            on_row(line);
+        }
+    }
+
+    /* The description from the file header, once it was fed */
+    std::optional<sqoa_desc> info() const {
+        sqoa_desc desc;
+        if (!decoder_ || !sqoa_decoder_info(decoder_, &desc)) {
+            return std::nullopt;
+        }
+        return desc;
+    }
+
+    /* Return the next row of pixels, valid until the next call to row, or an
+    empty span if it needs more bytes or all the rows were returned */
+    bytes row() {
+        const void *line = decoder_ ? sqoa_decoder_row(decoder_) : nullptr;
+        if (!line) {
+            return bytes();
+        }
+        if (stride_ == 0) {
+            sqoa_desc desc = *info();
+            stride_ = std::size_t(desc.width) * (channels_ ? channels_ : detail::pixel_channels(desc));
+        }
+        return bytes(static_cast<const unsigned char *>(line), stride_);
+    }
+
+    /* Check that all the rows were returned and the image ended where it
+    should */
+    void finish() {
+        if (!decoder_) {
+            throw error("sqoa: decoder already finished");
+        }
+        if (!sqoa_decoder_finish(std::exchange(decoder_, nullptr))) {
+            throw error("sqoa: decoding failed");
+        }
+    }
+
+private:
+    sqoa_decoder *decoder_ = nullptr;
+    int channels_ = 0;
+    std::size_t stride_ = 0;
+};
+
+
+/* Convert a SQOA or QOI image as sqoa_transcode does, passing the encoded
+bytes to a callable as for sqoa::encoder. Returns the total size of the
+converted image */
+template <class Write>
+std::size_t transcode(bytes data, const sqoa_desc &options, Write &write) {
+    int size = sqoa_transcode(data.data(), detail::to_int(data.size()), &options, &detail::write<Write>, &write);
+    if (!size) {
+        throw error("sqoa: transcoding failed");
+    }
+    return static_cast<std::size_t>(size);
+}
+
+} // namespace sqoa
+
+#endif /* SQOA_HPP */
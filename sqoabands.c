@@ -0,0 +1,245 @@
+/*
+
+Copyright (c) 2021, Dominic Szablewski - https://phoboslab.org
+SPDX-License-Identifier: MIT
+
+
+Command line tool to split a sqoa/qoi image into bands, and to fetch only some
+of the bands of a banded image the way a client would with HTTP range requests
+
+Requires:
+    -"seqoia.h" (https://github.com/jido/seqoia/blob/sqoa-format/seqoia.h)
+
+Compile with:
+    gcc sqoabands.c -std=c99 -O3 -o sqoabands
+
+The band images are served as they are in the banded file, the client only
+needs the header and band index first, then one range per run of bands. The
+file stands in for the server: every read is done as a range request would,
+and the bytes read are counted.
+
+*/
+
+
+#define SQOA_IMPLEMENTATION
+#include "seqoia.h"
+
+#include <limits.h>
+
+static long fetched = 0;
+
+// Stand-in for a range request "Range: bytes=offset-(offset+size-1)" to a
+// server that has the banded file
+static int fetch_range(FILE *f, unsigned int offset, unsigned int size, void *out) {
+    if (fseek(f, offset, SEEK_SET) != 0 || fread(out, 1, size, f) != size) {
+        return 0;
+    }
+    fetched += size;
+    return 1;
+}
+
+// Read the header and band index, the first SQOA_BAND_INDEX_SIZE(bands)
+// bytes, in two requests: the header tells the size of the index
+static unsigned char *fetch_index(FILE *f, sqoa_desc *desc, int *bands, int *index_size) {
+    unsigned char header[SQOA_BAND_INFO_SIZE];
+    unsigned char *index;
+
+    if (
+        !fetch_range(f, 0, SQOA_BAND_INFO_SIZE, header) ||
+        !(*bands = sqoa_band_index(header, SQOA_BAND_INFO_SIZE, desc, NULL, 0))
+    ) {
+        return NULL;
+    }
+
+    *index_size = SQOA_BAND_INDEX_SIZE(*bands);
+    index = malloc(*index_size);
+    if (!index) {
+        return NULL;
+    }
+    memcpy(index, header, SQOA_BAND_INFO_SIZE);
+    if (!fetch_range(f, SQOA_BAND_INFO_SIZE, *index_size - SQOA_BAND_INFO_SIZE, index + SQOA_BAND_INFO_SIZE)) {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+// Split a sqoa/qoi image into bands of band_height rows, each encoded with
+// the extensions of the image
+static int split(const char *in_path, int band_height, const char *out_path) {
+    sqoa_desc desc;
+    int size;
+    void *pixels = sqoa_read(in_path, &desc, 0);
+    if (!pixels) {
+        printf("Couldn't load/decode %s\n", in_path);
+        return 0;
+    }
+
+    desc.channels = (desc.channels < 3 ? 1 : 3) + ((desc.channels & 1) == 0);
+    void *banded = sqoa_band_encode(pixels, &desc, band_height, &size);
+    free(pixels);
+    if (!banded) {
+        printf("Couldn't split %s into bands\n", in_path);
+        return 0;
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    int result = out && fwrite(banded, 1, size, out) == (size_t)size;
+    if (out) {
+        result = (fclose(out) == 0) && result;
+    }
+    free(banded);
+    if (!result) {
+        printf("Couldn't write %s\n", out_path);
+    }
+    return result;
+}
+
+// Print the rows and byte range of every band
+static int list(const char *path) {
+    FILE *f = fopen(path, "rb");
+    sqoa_desc desc;
+    int bands, index_size;
+    unsigned char *index = f ? fetch_index(f, &desc, &bands, &index_size) : NULL;
+    sqoa_band *band = index ? malloc(bands * sizeof(sqoa_band)) : NULL;
+
+    if (!band || !sqoa_band_index(index, index_size, &desc, band, bands)) {
+        printf("Couldn't read band index %s\n", path);
+        free(index);
+        if (f) {
+            fclose(f);
+        }
+        return 0;
+    }
+
+    printf("%s: %u x %u, %d channels, %d bands, index bytes=0-%d\n",
+        path, desc.width, desc.height, desc.channels, bands, index_size - 1
+    );
+    for (int b = 0; b < bands; b++) {
+        printf("band %d\trows %u-%u\tbytes=%u-%u\n",
+            b, band[b].y, band[b].y + band[b].height - 1,
+            band[b].offset, band[b].offset + band[b].size - 1
+        );
+    }
+    free(band);
+    free(index);
+    fclose(f);
+    return 1;
+}
+
+// Write a banded image of count bands starting at first, from the header and
+// band index and the ranges of the band images, adjacent bands in one range
+static int fetch(const char *in_path, int first, int count, const char *out_path) {
+    FILE *f = fopen(in_path, "rb");
+    FILE *out = NULL;
+    sqoa_desc desc;
+    int bands, index_size, subset_size = 0, result = 0;
+    unsigned char *index = f ? fetch_index(f, &desc, &bands, &index_size) : NULL;
+    sqoa_band *band = index ? malloc(bands * sizeof(sqoa_band)) : NULL;
+    unsigned char *subset = band ? malloc(SQOA_BAND_INDEX_SIZE(count > 0 ? count : 0)) : NULL;
+
+    if (
+        subset && sqoa_band_index(index, index_size, &desc, band, bands) &&
+        (subset_size = sqoa_band_subset(index, index_size, first, count, subset, SQOA_BAND_INDEX_SIZE(count)))
+    ) {
+        out = fopen(out_path, "wb");
+        result = out && fwrite(subset, 1, subset_size, out) == (size_t)subset_size;
+    }
+
+    for (int b = first; result && b < first + count; ) {
+        unsigned int offset = band[b].offset, size = band[b++].size;
+        while (b < first + count && band[b].offset == offset + size && band[b].size <= INT_MAX - size) {
+            size += band[b++].size;
+        }
+        if (size == 0) {
+            continue;
+        }
+
+        void *range = malloc(size);
+        result = range && fetch_range(f, offset, size, range) && fwrite(range, 1, size, out) == size;
+        free(range);
+    }
+
+    if (out) {
+        result = (fclose(out) == 0) && result;
+    }
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        if (result) {
+            printf("Fetched %ld of %ld bytes for rows %u-%u\n", fetched, ftell(f),
+                band[first].y, band[first + count - 1].y + band[first + count - 1].height - 1
+            );
+        }
+        fclose(f);
+    }
+    free(subset);
+    free(band);
+    free(index);
+    if (!result) {
+        printf("Couldn't fetch bands %d to %d of %s into %s\n", first, first + count - 1, in_path, out_path);
+    }
+    return result;
+}
+
+// Check that the bands decode to the rows of the whole image
+static int check(const char *whole_path, const char *bands_path, int first_row) {
+    sqoa_desc desc, band_desc;
+    int result = 0;
+    void *whole = sqoa_read(whole_path, &desc, 4);
+
+    FILE *f = fopen(bands_path, "rb");
+    long size = -1;
+    void *data = NULL;
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = size > 0 && size <= INT_MAX ? malloc(size) : NULL;
+        if (data && fread(data, 1, size, f) != (size_t)size) {
+            free(data);
+            data = NULL;
+        }
+        fclose(f);
+    }
+
+    void *pixels = data ? sqoa_band_decode(data, (int)size, &band_desc, 4) : NULL;
+    if (
+        whole && pixels && band_desc.width == desc.width &&
+        first_row >= 0 && (unsigned int)first_row <= desc.height &&
+        band_desc.height <= desc.height - first_row
+    ) {
+        size_t row = (size_t)desc.width * 4;
+        result = memcmp((unsigned char *)whole + first_row * row, pixels, band_desc.height * row) == 0;
+    }
+    printf("%s: %s\n", bands_path, result ? "same rows" : "different");
+    free(pixels);
+    free(data);
+    free(whole);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2) {
+        return list(argv[1]) ? 0 : 1;
+    }
+    if (argc == 4) {
+        return split(argv[1], atoi(argv[2]), argv[3]) ? 0 : 1;
+    }
+    if (argc == 5 && strcmp(argv[1], "--check") == 0) {
+        return check(argv[2], argv[3], atoi(argv[4])) ? 0 : 1;
+    }
+    if (argc == 5) {
+        return fetch(argv[1], atoi(argv[2]), atoi(argv[3]), argv[4]) ? 0 : 1;
+    }
+
+    puts("Usage: sqoabands <infile> <band_height> <outfile>");
+    puts("       sqoabands <bandfile>");
+    puts("       sqoabands <bandfile> <first> <count> <outfile>");
+    puts("       sqoabands --check <infile> <bandfile> <first_row>");
+    puts("Examples:");
+    puts("  sqoabands input.sqoa 64 banded.sqbd");
+    puts("  sqoabands banded.sqbd");
+    puts("  sqoabands banded.sqbd 2 3 rows.sqbd");
+    puts("  sqoabands --check input.sqoa rows.sqbd 128");
+    return 1;
+}
@@ -13,6 +13,7 @@ Compile with:
 
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <dirent.h>
 #include <png.h>
@@ -294,6 +295,151 @@ void *fload(const char *path, int *out_size) {
 }
 
 
+// -----------------------------------------------------------------------------
+// file round trip helpers, used with --fileio
+// sqoa_read/sqoa_write go through stdio, these use mmap and O_DIRECT instead.
+
+#if defined(__linux) || defined(__APPLE__)
+    #define HAVE_MMAP
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#define IO_ALIGN 4096
+
+char io_path[1024];
+int io_direct_unsupported = 0;
+
+// Evict a file from the page cache so that the next read comes from the disk.
+// Only implemented on Linux, elsewhere the cache stays warm.
+void io_drop_cache(const char *path) {
+#if defined(__linux)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+#endif
+}
+
+#ifdef HAVE_MMAP
+void *io_mmap_read(const char *path, sqoa_desc *desc, int channels) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        ERROR("Can't open file %s", path);
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERROR("Can't mmap file %s", path);
+    }
+
+    void *pixels = sqoa_decode(map, st.st_size, desc, channels);
+    munmap(map, st.st_size);
+    return pixels;
+}
+
+int io_mmap_write(const char *path, const void *pixels, const sqoa_desc *desc) {
+    int size;
+    void *encoded = sqoa_encode(pixels, desc, &size);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!encoded || fd < 0 || ftruncate(fd, size) != 0) {
+        ERROR("Can't write file %s", path);
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ERROR("Can't mmap file %s", path);
+    }
+    memcpy(map, encoded, size);
+    munmap(map, size);
+    close(fd);
+    free(encoded);
+    return size;
+}
+#endif
+
+#ifdef O_DIRECT
+// O_DIRECT wants the buffer, offset and length aligned to the block size.
+// Returns NULL if the file system doesn't support direct I/O.
+void *io_direct_read(const char *path, sqoa_desc *desc, int channels) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        ERROR("Can't stat file %s", path);
+    }
+
+    size_t aligned = (st.st_size + IO_ALIGN - 1) & ~(size_t)(IO_ALIGN - 1);
+    void *buffer;
+    if (posix_memalign(&buffer, IO_ALIGN, aligned) != 0) {
+        ERROR("Malloc for %zu bytes failed", aligned);
+    }
+
+    size_t pos = 0;
+    while (pos < (size_t)st.st_size) {
+        ssize_t n = read(fd, (char *)buffer + pos, aligned - pos);
+        if (n <= 0) {
+            ERROR("Can't read file %s", path);
+        }
+        pos += n;
+    }
+    close(fd);
+
+    void *pixels = sqoa_decode(buffer, st.st_size, desc, channels);
+    free(buffer);
+    return pixels;
+}
+
+int io_direct_write(const char *path, const void *pixels, const sqoa_desc *desc) {
+    int size;
+    void *encoded = sqoa_encode(pixels, desc, &size);
+    if (!encoded) {
+        ERROR("Can't encode %s", path);
+    }
+
+    size_t aligned = (size + IO_ALIGN - 1) & ~(size_t)(IO_ALIGN - 1);
+    void *buffer;
+    if (posix_memalign(&buffer, IO_ALIGN, aligned) != 0) {
+        ERROR("Malloc for %zu bytes failed", aligned);
+    }
+    memcpy(buffer, encoded, size);
+    memset((char *)buffer + size, 0, aligned - size);
+    free(encoded);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0) {
+        free(buffer);
+        return 0;
+    }
+    if (write(fd, buffer, aligned) != (ssize_t)aligned || ftruncate(fd, size) != 0) {
+        ERROR("Can't write file %s", path);
+    }
+    close(fd);
+    free(buffer);
+    return size;
+}
+
+// Check once whether the temporary directory accepts O_DIRECT (tmpfs doesn't)
+void io_direct_probe(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_DIRECT, 0644);
+    if (fd < 0) {
+        io_direct_unsupported = 1;
+        return;
+    }
+    close(fd);
+}
+#endif
+
+
 // -----------------------------------------------------------------------------
 // benchmark runner
 
@@ -307,6 +453,13 @@ int opt_noencode = 0;
 int opt_norecurse = 0;
 int opt_noaverage = 0;
 int opt_onlytotals = 0;
+int opt_fileio = 0;
+int opt_dropcache = 0;
+int opt_simd = SQOA_SIMD_AUTO;
+
+// Experimental SQOA extensions, benchmarked as an extra "sqoa/x" row
+int opt_ext = 0;
+sqoa_desc opt_ext_desc = {0};
 
 
 typedef struct {
@@ -325,70 +478,91 @@ typedef struct {
     benchmark_lib_result_t stbi;
     benchmark_lib_result_t qoi;
     benchmark_lib_result_t sqoa;
+    benchmark_lib_result_t sqoa_ext;
+    benchmark_lib_result_t sqoa_stdio;
+    benchmark_lib_result_t sqoa_mmap;
+    benchmark_lib_result_t sqoa_direct;
 } benchmark_result_t;
 
 
+void benchmark_lib_average(benchmark_lib_result_t *lib, int count) {
+    lib->encode_time /= count;
+    lib->decode_time /= count;
+    lib->size /= count;
+}
+
+void benchmark_lib_add(benchmark_lib_result_t *total, benchmark_lib_result_t lib) {
+    total->encode_time += lib.encode_time;
+    total->decode_time += lib.decode_time;
+    total->size += lib.size;
+}
+
+void benchmark_lib_print(const char *name, benchmark_lib_result_t lib, double px, uint64_t raw_size) {
+    printf(
+        "%-8s%10.1f  %10.1f      %8.2f      %8.2f %9llu   %4.1f%%\n", 
+        name,
+        (double)lib.decode_time/1000000.0,
+        (double)lib.encode_time/1000000.0,
+        (lib.decode_time > 0 ? px / ((double)lib.decode_time/1000.0) : 0),
+        (lib.encode_time > 0 ? px / ((double)lib.encode_time/1000.0) : 0),
+        lib.size/1024,
+        ((double)lib.size/(double)raw_size) * 100.0
+    );
+}
+
 void benchmark_print_result(benchmark_result_t res) {
     if (opt_noaverage == 0) {
         res.px /= res.count;
-        res.libpng.encode_time /= res.count;
-        res.libpng.decode_time /= res.count;
-        res.stbi.encode_time /= res.count;
-        res.stbi.decode_time /= res.count;
-        res.qoi.encode_time /= res.count;
-        res.qoi.decode_time /= res.count;
-        res.sqoa.encode_time /= res.count;
-        res.sqoa.decode_time /= res.count;
         res.raw_size /= res.count;
-        res.libpng.size /= res.count;
-        res.stbi.size /= res.count;
-        res.qoi.size /= res.count;
-        res.sqoa.size /= res.count;
+        benchmark_lib_average(&res.libpng, res.count);
+        benchmark_lib_average(&res.stbi, res.count);
+        benchmark_lib_average(&res.qoi, res.count);
+        benchmark_lib_average(&res.sqoa, res.count);
+        benchmark_lib_average(&res.sqoa_ext, res.count);
+        benchmark_lib_average(&res.sqoa_stdio, res.count);
+        benchmark_lib_average(&res.sqoa_mmap, res.count);
+        benchmark_lib_average(&res.sqoa_direct, res.count);
     }
 
     double px = res.px;
     printf("         decode ms   encode ms   decode mpps   encode mpps   size kb    rate\n");
     if (!opt_nopng) {
-        printf(
-            "libpng: %10.1f  %10.1f      %8.2f      %8.2f %9llu   %4.1f%%\n", 
-            (double)res.libpng.decode_time/1000000.0, 
-            (double)res.libpng.encode_time/1000000.0, 
-            (res.libpng.decode_time > 0 ? px / ((double)res.libpng.decode_time/1000.0) : 0),
-            (res.libpng.encode_time > 0 ? px / ((double)res.libpng.encode_time/1000.0) : 0),
-            res.libpng.size/1024,
-            ((double)res.libpng.size/(double)res.raw_size) * 100.0
-        );
-        printf(
-            "stbi:   %10.1f  %10.1f      %8.2f      %8.2f %9llu   %4.1f%%\n", 
-            (double)res.stbi.decode_time/1000000.0,
-            (double)res.stbi.encode_time/1000000.0,
-            (res.stbi.decode_time > 0 ? px / ((double)res.stbi.decode_time/1000.0) : 0),
-            (res.stbi.encode_time > 0 ? px / ((double)res.stbi.encode_time/1000.0) : 0),
-            res.stbi.size/1024,
-            ((double)res.stbi.size/(double)res.raw_size) * 100.0
-        );
+        benchmark_lib_print("libpng:", res.libpng, px, res.raw_size);
+        benchmark_lib_print("stbi:", res.stbi, px, res.raw_size);
+    }
+    benchmark_lib_print("qoi:", res.qoi, px, res.raw_size);
+    benchmark_lib_print("sqoa:", res.sqoa, px, res.raw_size);
+    if (opt_ext) {
+        benchmark_lib_print("sqoa/x:", res.sqoa_ext, px, res.raw_size);
+    }
+    if (opt_fileio) {
+        benchmark_lib_print("sqoa/f:", res.sqoa_stdio, px, res.raw_size);
+#ifdef HAVE_MMAP
+        benchmark_lib_print("sqoa/m:", res.sqoa_mmap, px, res.raw_size);
+#endif
+#ifdef O_DIRECT
+        if (!io_direct_unsupported) {
+            benchmark_lib_print("sqoa/d:", res.sqoa_direct, px, res.raw_size);
+        }
+#endif
     }
-    printf(
-        "qoi:    %10.1f  %10.1f      %8.2f      %8.2f %9llu   %4.1f%%\n", 
-        (double)res.qoi.decode_time/1000000.0,
-        (double)res.qoi.encode_time/1000000.0,
-        (res.qoi.decode_time > 0 ? px / ((double)res.qoi.decode_time/1000.0) : 0),
-        (res.qoi.encode_time > 0 ? px / ((double)res.qoi.encode_time/1000.0) : 0),
-        res.qoi.size/1024,
-        ((double)res.qoi.size/(double)res.raw_size) * 100.0
-    );
-    printf(
-        "sqoa:   %10.1f  %10.1f      %8.2f      %8.2f %9llu   %4.1f%%\n", 
-        (double)res.sqoa.decode_time/1000000.0,
-        (double)res.sqoa.encode_time/1000000.0,
-        (res.sqoa.decode_time > 0 ? px / ((double)res.sqoa.decode_time/1000.0) : 0),
-        (res.sqoa.encode_time > 0 ? px / ((double)res.sqoa.encode_time/1000.0) : 0),
-        res.sqoa.size/1024,
-        ((double)res.sqoa.size/(double)res.raw_size) * 100.0
-    );
     printf("\n");
 }
 
+void benchmark_add_result(benchmark_result_t *total, benchmark_result_t res) {
+    total->count++;
+    total->raw_size += res.raw_size;
+    total->px += res.px;
+    benchmark_lib_add(&total->libpng, res.libpng);
+    benchmark_lib_add(&total->stbi, res.stbi);
+    benchmark_lib_add(&total->qoi, res.qoi);
+    benchmark_lib_add(&total->sqoa, res.sqoa);
+    benchmark_lib_add(&total->sqoa_ext, res.sqoa_ext);
+    benchmark_lib_add(&total->sqoa_stdio, res.sqoa_stdio);
+    benchmark_lib_add(&total->sqoa_mmap, res.sqoa_mmap);
+    benchmark_lib_add(&total->sqoa_direct, res.sqoa_direct);
+}
+
 // Run __VA_ARGS__ a number of times and measure the time taken. The first
 // run is ignored.
 #define BENCHMARK_FN(NOWARMUP, RUNS, AVG_TIME, ...) \
@@ -405,6 +579,25 @@ void benchmark_print_result(benchmark_result_t res) {
         AVG_TIME = time / RUNS; \
     } while (0)
 
+// Same as BENCHMARK_FN, for reading back a file. With --dropcache the file is
+// evicted from the page cache before every run, outside of the timed region.
+#define BENCHMARK_IO_FN(NOWARMUP, RUNS, AVG_TIME, PATH, ...) \
+    do { \
+        uint64_t time = 0; \
+        for (int i = NOWARMUP; i <= RUNS; i++) { \
+            if (opt_dropcache) { \
+                io_drop_cache(PATH); \
+            } \
+            uint64_t time_start = ns(); \
+            __VA_ARGS__ \
+            uint64_t time_end = ns(); \
+            if (i > 0) { \
+                time += time_end - time_start; \
+            } \
+        } \
+        AVG_TIME = time / RUNS; \
+    } while (0)
+
 
 benchmark_result_t benchmark_image(const char *path) {
     int encoded_png_size;
@@ -443,6 +636,21 @@ benchmark_result_t benchmark_image(const char *path) {
         ERROR("Error encoding %s", path);
     }
 
+    sqoa_desc ext_desc = opt_ext_desc;
+    ext_desc.width = w;
+    ext_desc.height = h;
+    ext_desc.channels = channels;
+    ext_desc.colorspace = SQOA_SRGB;
+
+    int encoded_ext_size = 0;
+    void *encoded_ext = NULL;
+    if (opt_ext) {
+        encoded_ext = sqoa_encode(pixels, &ext_desc, &encoded_ext_size);
+        if (!encoded_ext) {
+            ERROR("Error encoding %s with extensions", path);
+        }
+    }
+
     // Verify SQOA Output
 
     if (!opt_noverify) {
@@ -452,6 +660,17 @@ benchmark_result_t benchmark_image(const char *path) {
             ERROR("SQOA roundtrip pixel mismatch for %s", path);
         }
         free(pixels_sqoa);
+
+        if (opt_ext) {
+            if (!sqoa_validate(encoded_ext, encoded_ext_size, &dc)) {
+                ERROR("SQOA extensions validation failed for %s", path);
+            }
+            void *pixels_ext = sqoa_decode(encoded_ext, encoded_ext_size, &dc, channels);
+            if (memcmp(pixels, pixels_ext, w * h * channels) != 0) {
+                ERROR("SQOA extensions roundtrip pixel mismatch for %s", path);
+            }
+            free(pixels_ext);
+        }
     }
 
 
@@ -463,6 +682,33 @@ benchmark_result_t benchmark_image(const char *path) {
     res.w = w;
     res.h = h;
 
+    sqoa_desc io_desc = {
+        .width = w,
+        .height = h,
+        .channels = channels,
+        .colorspace = SQOA_SRGB,
+        .qoi_compat = 0
+    };
+
+    if (opt_fileio) {
+        if (!sqoa_write(io_path, pixels, &io_desc)) {
+            ERROR("Can't write %s", io_path);
+        }
+
+        if (!opt_noverify) {
+            sqoa_desc dc;
+            void *pixels_file = sqoa_read(io_path, &dc, channels);
+            if (!pixels_file || memcmp(pixels, pixels_file, w * h * channels) != 0) {
+                ERROR("SQOA file roundtrip pixel mismatch for %s", path);
+            }
+            free(pixels_file);
+        }
+
+        res.sqoa_stdio.size = encoded_sqoa_size;
+        res.sqoa_mmap.size = encoded_sqoa_size;
+        res.sqoa_direct.size = encoded_sqoa_size;
+    }
+
 
     // Decoding
 
@@ -492,6 +738,40 @@ benchmark_result_t benchmark_image(const char *path) {
             void *dec_p = sqoa_decode(encoded_sqoa, encoded_sqoa_size, &desc, 4);
             free(dec_p);
         });
+
+        if (opt_ext) {
+            BENCHMARK_FN(opt_nowarmup, opt_runs, res.sqoa_ext.decode_time, {
+                sqoa_desc desc;
+                void *dec_p = sqoa_decode(encoded_ext, encoded_ext_size, &desc, 4);
+                free(dec_p);
+            });
+        }
+
+        if (opt_fileio) {
+            BENCHMARK_IO_FN(opt_nowarmup, opt_runs, res.sqoa_stdio.decode_time, io_path, {
+                sqoa_desc desc;
+                void *dec_p = sqoa_read(io_path, &desc, 4);
+                free(dec_p);
+            });
+
+#ifdef HAVE_MMAP
+            BENCHMARK_IO_FN(opt_nowarmup, opt_runs, res.sqoa_mmap.decode_time, io_path, {
+                sqoa_desc desc;
+                void *dec_p = io_mmap_read(io_path, &desc, 4);
+                free(dec_p);
+            });
+#endif
+
+#ifdef O_DIRECT
+            if (!io_direct_unsupported) {
+                BENCHMARK_IO_FN(opt_nowarmup, opt_runs, res.sqoa_direct.decode_time, io_path, {
+                    sqoa_desc desc;
+                    void *dec_p = io_direct_read(io_path, &desc, 4);
+                    free(dec_p);
+                });
+            }
+#endif
+        }
     }
 
 
@@ -536,12 +816,42 @@ benchmark_result_t benchmark_image(const char *path) {
             res.sqoa.size = enc_size;
             free(enc_p);
         });
+
+        if (opt_ext) {
+            BENCHMARK_FN(opt_nowarmup, opt_runs, res.sqoa_ext.encode_time, {
+                int enc_size;
+                void *enc_p = sqoa_encode(pixels, &ext_desc, &enc_size);
+                res.sqoa_ext.size = enc_size;
+                free(enc_p);
+            });
+        }
+
+        if (opt_fileio) {
+            BENCHMARK_FN(opt_nowarmup, opt_runs, res.sqoa_stdio.encode_time, {
+                sqoa_write(io_path, pixels, &io_desc);
+            });
+
+#ifdef HAVE_MMAP
+            BENCHMARK_FN(opt_nowarmup, opt_runs, res.sqoa_mmap.encode_time, {
+                io_mmap_write(io_path, pixels, &io_desc);
+            });
+#endif
+
+#ifdef O_DIRECT
+            if (!io_direct_unsupported) {
+                BENCHMARK_FN(opt_nowarmup, opt_runs, res.sqoa_direct.encode_time, {
+                    io_direct_write(io_path, pixels, &io_desc);
+                });
+            }
+#endif
+        }
     }
 
     free(pixels);
     free(encoded_png);
     free(encoded_qoi);
     free(encoded_sqoa);
+    free(encoded_ext);
 
     return res;
 }
@@ -594,37 +904,8 @@ void benchmark_directory(const char *path, benchmark_result_t *grand_total) {
 
         free(file_path);
         
-        dir_total.count++;
-        dir_total.raw_size += res.raw_size;
-        dir_total.px += res.px;
-        dir_total.libpng.encode_time += res.libpng.encode_time;
-        dir_total.libpng.decode_time += res.libpng.decode_time;
-        dir_total.libpng.size += res.libpng.size;
-        dir_total.stbi.encode_time += res.stbi.encode_time;
-        dir_total.stbi.decode_time += res.stbi.decode_time;
-        dir_total.stbi.size += res.stbi.size;
-        dir_total.qoi.encode_time += res.qoi.encode_time;
-        dir_total.qoi.decode_time += res.qoi.decode_time;
-        dir_total.qoi.size += res.qoi.size;
-        dir_total.sqoa.encode_time += res.sqoa.encode_time;
-        dir_total.sqoa.decode_time += res.sqoa.decode_time;
-        dir_total.sqoa.size += res.sqoa.size;
-
-        grand_total->count++;
-        grand_total->raw_size += res.raw_size;
-        grand_total->px += res.px;
-        grand_total->libpng.encode_time += res.libpng.encode_time;
-        grand_total->libpng.decode_time += res.libpng.decode_time;
-        grand_total->libpng.size += res.libpng.size;
-        grand_total->stbi.encode_time += res.stbi.encode_time;
-        grand_total->stbi.decode_time += res.stbi.decode_time;
-        grand_total->stbi.size += res.stbi.size;
-        grand_total->qoi.encode_time += res.qoi.encode_time;
-        grand_total->qoi.decode_time += res.qoi.decode_time;
-        grand_total->qoi.size += res.qoi.size;
-        grand_total->sqoa.encode_time += res.sqoa.encode_time;
-        grand_total->sqoa.decode_time += res.sqoa.decode_time;
-        grand_total->sqoa.size += res.sqoa.size;
+        benchmark_add_result(&dir_total, res);
+        benchmark_add_result(grand_total, res);
     }
     closedir(dir);
 
@@ -646,9 +927,23 @@ int main(int argc, char **argv) {
         printf("    --norecurse .. don't descend into directories\n");
         printf("    --noaverage .. don't average times and file sizes\n");
         printf("    --onlytotals . don't print individual image results\n");
+        printf("    --fileio ..... also time sqoa file round trips (stdio, mmap, O_DIRECT)\n");
+        printf("                   through a temporary file in $TMPDIR\n");
+        printf("    --dropcache .. with --fileio, evict the file from the page cache\n");
+        printf("                   before each read (Linux only)\n");
+        printf("    --simd=X ..... force the SIMD kernels, X is scalar, sse4.1, avx2 or avx512\n");
+        printf("                   (lowered to what the CPU supports)\n");
+        printf("Experimental SQOA extensions, compared in an extra sqoa/x row:\n");
+        printf("    --index ...... colour index cache\n");
+        printf("    --predict=X .. predict from the row above, X is up, avg or paeth\n");
+        printf("    --ycocg ...... YCoCg-R colour transform\n");
+        printf("    --effort=N ... encoder effort 1 or 2, slower and smaller\n");
+        printf("    --checksum ... CRC-32C trailer, verified with sqoa_validate\n");
         printf("Examples\n");
         printf("    sqoabench 10 images/textures/\n");
         printf("    sqoabench 1 images/textures/ --nopng --nowarmup\n");
+        printf("    sqoabench 10 images/ --nopng --fileio --dropcache\n");
+        printf("    sqoabench 10 images/icon_64/ --nopng --index\n");
         exit(1);
     }
 
@@ -661,6 +956,20 @@ int main(int argc, char **argv) {
         else if (strcmp(argv[i], "--norecurse") == 0) { opt_norecurse = 1; }
         else if (strcmp(argv[i], "--noaverage") == 0) { opt_noaverage = 1; }
         else if (strcmp(argv[i], "--onlytotals") == 0) { opt_onlytotals = 1; }
+        else if (strcmp(argv[i], "--fileio") == 0) { opt_fileio = 1; }
+        else if (strcmp(argv[i], "--dropcache") == 0) { opt_dropcache = 1; }
+        else if (strcmp(argv[i], "--simd=scalar") == 0) { opt_simd = SQOA_SIMD_SCALAR; }
+        else if (strcmp(argv[i], "--simd=sse4.1") == 0) { opt_simd = SQOA_SIMD_SSE41; }
+        else if (strcmp(argv[i], "--simd=avx2") == 0) { opt_simd = SQOA_SIMD_AVX2; }
+        else if (strcmp(argv[i], "--simd=avx512") == 0) { opt_simd = SQOA_SIMD_AVX512; }
+        else if (strcmp(argv[i], "--index") == 0) { opt_ext = 1; opt_ext_desc.index_cache = 1; }
+        else if (strcmp(argv[i], "--predict=up") == 0) { opt_ext = 1; opt_ext_desc.predictor = SQOA_PRED_UP; }
+        else if (strcmp(argv[i], "--predict=avg") == 0) { opt_ext = 1; opt_ext_desc.predictor = SQOA_PRED_AVG; }
+        else if (strcmp(argv[i], "--predict=paeth") == 0) { opt_ext = 1; opt_ext_desc.predictor = SQOA_PRED_PAETH; }
+        else if (strcmp(argv[i], "--ycocg") == 0) { opt_ext = 1; opt_ext_desc.transform = SQOA_TRANSFORM_YCOCG_R; }
+        else if (strcmp(argv[i], "--effort=1") == 0) { opt_ext = 1; opt_ext_desc.effort = 1; }
+        else if (strcmp(argv[i], "--effort=2") == 0) { opt_ext = 1; opt_ext_desc.effort = 2; }
+        else if (strcmp(argv[i], "--checksum") == 0) { opt_ext = 1; opt_ext_desc.checksum = 1; }
         else { ERROR("Unknown option %s", argv[i]); }
     }
 
@@ -669,9 +978,28 @@ int main(int argc, char **argv) {
         ERROR("Invalid number of runs %d", opt_runs);
     }
 
+    static const char *simd_names[] = {"scalar", "sse4.1", "avx2", "avx512"};
+    int simd = sqoa_set_simd_level(opt_simd);
+    if (opt_simd != SQOA_SIMD_AUTO && simd != opt_simd) {
+        printf("SIMD level %s not supported, using %s\n", simd_names[opt_simd], simd_names[simd]);
+    }
+    printf("# SIMD kernels: %s\n\n", simd_names[simd]);
+
+    if (opt_fileio) {
+        const char *tmpdir = getenv("TMPDIR");
+        snprintf(io_path, sizeof(io_path), "%s/sqoabench-io.sqoa", tmpdir ? tmpdir : "/tmp");
+#ifdef O_DIRECT
+        io_direct_probe(io_path);
+#endif
+    }
+
     benchmark_result_t grand_total = {0};
     benchmark_directory(argv[2], &grand_total);
 
+    if (opt_fileio) {
+        remove(io_path);
+    }
+
     if (grand_total.count > 0) {
         printf("# Grand total for %s\n", argv[2]);
         benchmark_print_result(grand_total);
@@ -5,7 +5,8 @@ Copyright (c) 2021, Dominic Szablewski - https://phoboslab.org
 SPDX-License-Identifier: MIT
 
 
-Command line tool to convert between png <> sqoa <> qoi > jpg format
+Command line tool to convert between png <> sqoa <> qoi > jpg format, or to
+print the description of many sqoa/qoi files from their headers
 
 Requires:
     -"stb_image.h" (https://github.com/nothings/stb/blob/master/stb_image.h)
@@ -16,6 +17,13 @@ Requires:
 Compile with: 
     gcc sqoaconv.c -std=c99 -O3 -o sqoaconv
 
+Conversions between sqoa and qoi re-encode the image one row at a time, without
+decoding the whole image first.
+
+Optionally, PNG files can be converted to sqoa/qoi one row at a time, without
+decoding the whole image first, by using libpng:
+    gcc sqoaconv.c -std=c99 -O3 -DSQOACONV_LIBPNG -lpng -o sqoaconv
+
 */
 
 
@@ -33,18 +41,234 @@ Compile with:
 #define SQOA_IMPLEMENTATION
 #include "seqoia.h"
 
+#include <limits.h>
+
 #define STR_ENDS_WITH(S, E) (strcmp(S + strlen(S) - (sizeof(E)-1), E) == 0)
 
+static int write_file(void *user, const void *data, int size) {
+    return fwrite(data, 1, size, (FILE *)user) == (size_t)size;
+}
+
+// Convert between sqoa and qoi without decoding the whole image: only the
+// encoded input is loaded, the pixels are re-encoded one row at a time.
+static int sqoa_transcode_file(const char *in_path, const char *out_path, int qoi_compat) {
+    FILE *in = fopen(in_path, "rb");
+    if (!in) {
+        return 0;
+    }
+
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    if (size <= 0 || size > INT_MAX) {
+        fclose(in);
+        return 0;
+    }
+
+    void *data = malloc(size);
+    int result = data && fread(data, 1, size, in) == (size_t)size;
+    fclose(in);
+
+    if (result) {
+        FILE *out = fopen(out_path, "wb");
+        result = out != NULL;
+        if (out) {
+            result = sqoa_transcode(data, (int)size, &(sqoa_desc){
+                .qoi_compat = qoi_compat
+            }, write_file, out) > 0;
+            result = (fclose(out) == 0) && result;
+        }
+    }
+    free(data);
+    return result;
+}
+
+#ifdef SQOACONV_LIBPNG
+#include <png.h>
+
+// Convert a PNG file to sqoa/qoi, feeding the rows from libpng straight into
+// the streaming encoder. The pixels are converted like stbi_load does above.
+// Returns 1 on success, 0 on failure or -1 for interlaced images, which need
+// the whole image to be decoded first.
+static int png_transcode(const char *in_path, const char *out_path, int qoi_compat) {
+    FILE *in = fopen(in_path, "rb");
+    if (!in) {
+        return 0;
+    }
+
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    FILE *volatile out = NULL;
+    sqoa_encoder *volatile encoder = NULL;
+    png_bytep volatile row = NULL;
+    int volatile result = 0;
+
+    if (!info || setjmp(png_jmpbuf(png))) {
+        if (encoder) {
+            sqoa_encoder_finish(encoder);
+        }
+        if (out) {
+            fclose(out);
+        }
+        free(row);
+        png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+        fclose(in);
+        return result;
+    }
+
+    png_init_io(png, in);
+    png_read_info(png, info);
+
+    png_uint_32 w, h;
+    int bit_depth, color_type, interlace_type;
+    png_get_IHDR(png, info, &w, &h, &bit_depth, &color_type, &interlace_type, NULL, NULL);
+    if (interlace_type != PNG_INTERLACE_NONE) {
+        result = -1;
+        png_longjmp(png, 1);
+    }
+
+    png_set_strip_16(png);
+    png_set_packing(png);
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png);
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
+        png_set_expand_gray_1_2_4_to_8(png);
+    }
+    int channels = (color_type & PNG_COLOR_MASK_COLOR) ? 3 : 1;
+    if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+        png_set_tRNS_to_alpha(png);
+        channels += 1;
+    }
+    else if (color_type & PNG_COLOR_MASK_ALPHA) {
+        channels += 1;
+    }
+
+    // Force all odd encodings to be RGBA, as for stbi_load
+    if ((channels & 1) != 0) {
+        png_set_add_alpha(png, 0xff, PNG_FILLER_AFTER);
+        channels += 1;
+    }
+    if (qoi_compat && channels < 3) {
+        png_set_gray_to_rgb(png);
+        channels += 2;
+    }
+    png_read_update_info(png, info);
+
+    row = malloc(png_get_rowbytes(png, info));
+    out = fopen(out_path, "wb");
+    if (row && out) {
+        encoder = sqoa_encoder_create(&(sqoa_desc){
+            .width = w,
+            .height = h,
+            .channels = channels,
+            .colorspace = SQOA_SRGB,
+            .qoi_compat = qoi_compat
+        }, write_file, out);
+    }
+    if (!encoder) {
+        png_longjmp(png, 1);
+    }
+
+    for (png_uint_32 y = 0; y < h; y++) {
+        png_read_row(png, row, NULL);
+        if (!sqoa_encoder_rows(encoder, row, 1)) {
+            png_longjmp(png, 1);
+        }
+    }
+    png_read_end(png, NULL);
+
+    result = sqoa_encoder_finish(encoder) > 0;
+    encoder = NULL;
+    result = (fclose(out) == 0) && result;
+    out = NULL;
+    png_longjmp(png, 1);
+}
+#endif
+
+// Print one line per file: path width height channels colorspace format.
+// Only the header of each file is read, stdout is fully buffered.
+static int print_info(const char *path) {
+    sqoa_desc desc;
+    if (!sqoa_read_info(path, &desc)) {
+        fprintf(stderr, "Couldn't read header %s\n", path);
+        return 0;
+    }
+    printf("%s\t%u\t%u\t%d\t%s\t%s\n",
+        path, desc.width, desc.height, desc.channels,
+        desc.colorspace == SQOA_LINEAR ? "linear" : "srgb",
+        desc.qoi_compat ? "qoi" : "sqoa"
+    );
+    return 1;
+}
+
+static int info_mode(int argc, char **argv) {
+    static char out_buf[1 << 16];
+    int failed = 0;
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++) {
+            failed += !print_info(argv[i]);
+        }
+    }
+    else {
+        // No file arguments: read the paths from stdin, one per line
+        char path[4096];
+        while (fgets(path, sizeof(path), stdin)) {
+            path[strcspn(path, "\r\n")] = '\0';
+            if (path[0] != '\0') {
+                failed += !print_info(path);
+            }
+        }
+    }
+    fflush(stdout);
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "--info") == 0) {
+        return info_mode(argc, argv);
+    }
+
     if (argc < 3) {
         puts("Usage: sqoaconv <infile> <outfile>");
+        puts("       sqoaconv --info [file...]");
         puts("Examples:");
         puts("  sqoaconv input.png output.sqoa");
         puts("  sqoaconv input.qoi output.png");
         puts("  sqoaconv input.sqoa output.jpg");
+        puts("  find images -name '*.sqoa' | sqoaconv --info");
         exit(1);
     }
 
+    if (
+        (STR_ENDS_WITH(argv[1], ".sqoa") || STR_ENDS_WITH(argv[1], ".qoi")) &&
+        (STR_ENDS_WITH(argv[2], ".sqoa") || STR_ENDS_WITH(argv[2], ".qoi"))
+    ) {
+        if (!sqoa_transcode_file(argv[1], argv[2], STR_ENDS_WITH(argv[2], ".qoi"))) {
+            printf("Couldn't convert %s to %s\n", argv[1], argv[2]);
+            exit(1);
+        }
+        return 0;
+    }
+
+#ifdef SQOACONV_LIBPNG
+    if (
+        STR_ENDS_WITH(argv[1], ".png") &&
+        (STR_ENDS_WITH(argv[2], ".sqoa") || STR_ENDS_WITH(argv[2], ".qoi"))
+    ) {
+        int transcoded = png_transcode(argv[1], argv[2], STR_ENDS_WITH(argv[2], ".qoi"));
+        if (transcoded > 0) {
+            return 0;
+        }
+        if (transcoded == 0) {
+            printf("Couldn't convert %s to %s\n", argv[1], argv[2]);
+            exit(1);
+        }
+    }
+#endif
+
     void *pixels = NULL;
     int w, h, channels;
     if (STR_ENDS_WITH(argv[1], ".png")) {
@@ -4,29 +4,689 @@ Copyright (c) 2021, Dominic Szablewski - https://phoboslab.org
 SPDX-License-Identifier: MIT
 
 
-clang fuzzing harness for qoi_decode
+clang fuzzing harnesses for seqoia.h
 
-Compile and run with: 
+Compile and run with:
 	clang -fsanitize=address,fuzzer -g -O0 sqoafuzz.c && ./a.out
 
+The default harness fuzzes the decoders. The first byte of the input chooses
+the channels, scale and frame, the rest is decoded as a SQOA/QOI image, a SQAN
+animation and a banded image. An image that decodes is also decoded with the
+scalar kernels, into a buffer, at a smaller scale, incrementally from pieces of
+its bytes and transcoded, and the results compared. The last bands of a banded
+image are decoded again on their own.
+
+Define SQOAFUZZ_ROUNDTRIP to fuzz the encoders instead:
+	clang -fsanitize=address,fuzzer -g -O0 -DSQOAFUZZ_ROUNDTRIP sqoafuzz.c
+
+The first 4 bytes of the input choose the channel layout, qoi_compat, the
+extensions, the effort, the width and how the pixels are tiled into a larger
+image, the rest are the pixels. They are encoded with sqoa_encode and the
+scalar kernels, sqoa_encode_into, the streaming encoder, sqoa_band_encode and
+sqoa_anim_encode, then decoded again to every number of channels, also with the
+incremental decoder.
+
+Define SQOAFUZZ_QOI to compare the QOI mode with the reference qoi.h
+(https://github.com/phoboslab/qoi/blob/master/qoi.h):
+	clang -fsanitize=address,fuzzer -g -O0 -DSQOAFUZZ_QOI -I../qoi sqoafuzz.c
+
+If the first byte of the input is even, the rest is decoded by both and the
+pixels of valid images compared. Otherwise it is encoded as RGB or RGBA pixels
+by both and each image decoded by the other.
+
+The harnesses abort() when two results that should match differ.
+
 */
 
 
+#ifdef SQOAFUZZ_QOI
+#define QOI_IMPLEMENTATION
+#include "qoi.h"
+#endif
+
 #define SQOA_IMPLEMENTATION
 #include "seqoia.h"
 #include <stddef.h>
 #include <stdint.h>
+#include <limits.h>
+
+/* The encoded bytes collected from a sqoa_write_func */
+typedef struct {
+	unsigned char *data;
+	int size;
+	int capacity;
+} fuzz_buffer;
+
+static int fuzz_write(void *user, const void *data, int size) {
+	fuzz_buffer *buffer = (fuzz_buffer *)user;
+	if (size > buffer->capacity - buffer->size) {
+		int capacity = buffer->size + size + 4096;
+		unsigned char *grown = realloc(buffer->data, capacity);
+		if (grown == NULL) {
+			return 0;
+		}
+		buffer->data = grown;
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+	return 1;
+}
+
+/* The number of channels sqoa_decode returns for channels = 0 */
+static int fuzz_channels(const sqoa_desc *desc) {
+	return (desc->channels < 3 ? 1 : 3) + ((desc->channels & 1) == 0);
+}
+
+/* Check that scaled is the average of each scale x scale block of pixels, as
+sqoa_decode_scaled computes it */
+static void fuzz_check_scaled(const unsigned char *pixels, const unsigned char *scaled, int width, int height, int channels, int scale) {
+	int out_width = (width + scale - 1) / scale;
+	int out_height = (height + scale - 1) / scale;
+
+	for (int oy = 0; oy < out_height; oy++) {
+		for (int ox = 0; ox < out_width; ox++) {
+			for (int c = 0; c < channels; c++) {
+				unsigned int sum = 0, count = 0;
+				for (int y = oy * scale; y < oy * scale + scale && y < height; y++) {
+					for (int x = ox * scale; x < ox * scale + scale && x < width; x++) {
+						sum += pixels[(y * width + x) * channels + c];
+						count++;
+					}
+				}
+				if (scaled[(oy * out_width + ox) * channels + c] != (sum + count / 2) / count) {
+					abort();
+				}
+			}
+		}
+	}
+}
+
+/* Decode encoded with sqoa_decoder, fed in pieces of 1 to 64 bytes chosen
+from seed, taking the rows as soon as they are decoded. Returns the pixels only
+if sqoa_decoder_finish succeeds. */
+static unsigned char *fuzz_stream_decode(const void *encoded, int size, int channels, unsigned int seed) {
+	sqoa_decoder *decoder = sqoa_decoder_create(channels);
+	unsigned char *pixels = NULL;
+	size_t stride = 0, rows = 0;
+	int p = 0, ok = decoder != NULL;
+
+	while (ok && p < size) {
+		int piece = 1 + (seed = seed * 1103515245 + 12345) % 64;
+		if (piece > size - p) {
+			piece = size - p;
+		}
+		ok = sqoa_decoder_feed(decoder, (const unsigned char *)encoded + p, piece);
+		p += piece;
+
+		const unsigned char *row;
+		while (ok && (row = sqoa_decoder_row(decoder)) != NULL) {
+			if (pixels == NULL) {
+				sqoa_desc desc;
+				if (!sqoa_decoder_info(decoder, &desc)) {
+					abort();
+				}
+				stride = (size_t)desc.width * (channels ? channels : fuzz_channels(&desc));
+				pixels = malloc(stride * desc.height);
+				ok = pixels != NULL;
+			}
+			if (ok) {
+				memcpy(pixels + rows++ * stride, row, stride);
+			}
+		}
+	}
+	if (!sqoa_decoder_finish(decoder) || !ok) {
+		free(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+#if defined(SQOAFUZZ_ROUNDTRIP)
+
+/* Convert count pixels of src_channels to dst_channels the way the decoder
+does: grey is copied to r, g and b, colour is reduced to g, a missing alpha is
+255 */
+static void fuzz_convert(const unsigned char *src, int src_channels, unsigned char *dst, int dst_channels, int count) {
+	int color = src_channels >= 3;
+	int alpha = (src_channels & 1) == 0;
+
+	for (int i = 0; i < count; i++) {
+		const unsigned char *s = src + i * src_channels;
+		unsigned char *d = dst + i * dst_channels;
+		unsigned char g = color ? s[1] : s[0];
+		if (dst_channels >= 3) {
+			d[0] = color ? s[0] : g;
+			d[1] = g;
+			d[2] = color ? s[2] : g;
+		}
+		else {
+			d[0] = g;
+		}
+		if ((dst_channels & 1) == 0) {
+			d[dst_channels - 1] = alpha ? s[src_channels - 1] : 255;
+		}
+	}
+}
+
+/* Decode encoded to every number of channels, with the SIMD and the scalar
+kernels, and compare with pixels */
+static void fuzz_check_decode(const void *encoded, int size, const sqoa_desc *desc, const unsigned char *pixels) {
+	int width = desc->width, height = desc->height;
+	int px_channels = fuzz_channels(desc);
+	unsigned char *expected = malloc((size_t)width * height * 4);
+	if (expected == NULL) {
+		return;
+	}
+
+	for (int channels = 0; channels <= 4; channels++) {
+		int out_channels = channels ? channels : px_channels;
+		size_t len = (size_t)width * height * out_channels;
+		sqoa_desc out_desc;
+
+		fuzz_convert(pixels, px_channels, expected, out_channels, width * height);
+		unsigned char *decoded = sqoa_decode(encoded, size, &out_desc, channels);
+		sqoa_set_simd_level(SQOA_SIMD_SCALAR);
+		unsigned char *scalar = sqoa_decode(encoded, size, &out_desc, channels);
+		sqoa_set_simd_level(SQOA_SIMD_AUTO);
+		unsigned char *streamed = fuzz_stream_decode(encoded, size, channels, size + channels);
+
+		if (
+			decoded == NULL || scalar == NULL || streamed == NULL ||
+			memcmp(decoded, expected, len) != 0 ||
+			memcmp(scalar, expected, len) != 0 ||
+			memcmp(streamed, expected, len) != 0
+		) {
+			abort();
+		}
+		free(streamed);
+
+		if (channels == 0) {
+			for (int scale = 2; scale <= 8; scale *= 2) {
+				unsigned char *scaled = sqoa_decode_scaled(encoded, size, &out_desc, channels, scale);
+				if (scaled == NULL) {
+					abort();
+				}
+				fuzz_check_scaled(decoded, scaled, width, height, out_channels, scale);
+				free(scaled);
+			}
+		}
+		free(decoded);
+		free(scalar);
+	}
+	free(expected);
+}
 
 int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-	int w, h;
-	if (size < 4) {
+	if (size < 5 || size > INT_MAX) {
+		return 0;
+	}
+
+	sqoa_desc desc = {0};
+	desc.channels = data[0] % 6 + 1;
+	desc.colorspace = (data[0] / 6) & 1;
+	desc.qoi_compat = data[1] & 1;
+	if (!desc.qoi_compat) {
+		desc.index_cache = (data[1] >> 1) & 1;
+		desc.predictor = (data[1] >> 2) & 3;
+		desc.transform = (data[1] >> 4) & 1;
+		desc.checksum = (data[1] >> 5) & 1;
+	}
+	desc.effort = (data[1] >> 6) % (SQOA_EFFORT_MAX + 1);
+
+	// The input pixels are tiled up to 8 times across and 128 times down
+	int px_channels = fuzz_channels(&desc);
+	int tile_width = data[2] + 1;
+	int tile_height = (int)(size - 4) / (tile_width * px_channels);
+	int tiles_x = 1 << (data[3] & 3);
+	int tiles_y = 1 << ((data[3] >> 2) & 7);
+	int rows_per_call = (data[3] >> 5) + 1;
+	if (tile_height == 0) {
+		return 0;
+	}
+	if (tile_width * tile_height * tiles_x * tiles_y > (1 << 22)) {
+		tiles_x = tiles_y = 1;
+	}
+	desc.width = tile_width * tiles_x;
+	desc.height = tile_height * tiles_y;
+
+	int stride = desc.width * px_channels;
+	int tile_stride = tile_width * px_channels;
+	size_t px_len = (size_t)stride * desc.height;
+	unsigned char *pixels = malloc(px_len);
+	unsigned char *changed = malloc(px_len);
+	if (pixels == NULL || changed == NULL) {
+		free(pixels);
+		free(changed);
 		return 0;
 	}
+	for (int y = 0; y < (int)desc.height; y++) {
+		for (int x = 0; x < tiles_x; x++) {
+			memcpy(
+				pixels + y * stride + x * tile_stride,
+				data + 4 + (y % tile_height) * tile_stride, tile_stride
+			);
+		}
+	}
+
+	// The same pixels with one of them changed, for the updates and frames
+	sqoa_rect rect = {desc.width / 2, desc.height / 2, 1, 1};
+	memcpy(changed, pixels, px_len);
+	changed[rect.y * stride + rect.x * px_channels] ^= 0x5a;
+
+	int encoded_size, scalar_size;
+	void *encoded = sqoa_encode(pixels, &desc, &encoded_size);
+	sqoa_set_simd_level(SQOA_SIMD_SCALAR);
+	void *scalar = sqoa_encode(pixels, &desc, &scalar_size);
+	sqoa_set_simd_level(SQOA_SIMD_AUTO);
+
+	if (desc.qoi_compat && desc.channels < 3) {
+		// QOI has no grey images
+		if (encoded != NULL || scalar != NULL) {
+			abort();
+		}
+		free(pixels);
+		free(changed);
+		return 0;
+	}
+	if (
+		encoded == NULL || scalar == NULL ||
+		encoded_size != scalar_size ||
+		memcmp(encoded, scalar, encoded_size) != 0
+	) {
+		abort();
+	}
+	free(scalar);
 
+	// Encoding into a buffer of sqoa_encode_bound bytes gives the same bytes
+	int bound = sqoa_encode_bound(&desc);
+	unsigned char *into = malloc(bound);
+	if (
+		into == NULL || bound < encoded_size ||
+		sqoa_encode_into(pixels, &desc, into, bound - 1) != 0 ||
+		sqoa_encode_into(pixels, &desc, into, bound) != encoded_size ||
+		memcmp(into, encoded, encoded_size) != 0
+	) {
+		abort();
+	}
+	free(into);
+
+	sqoa_desc valid_desc;
+	if (
+		!sqoa_validate(encoded, encoded_size, &valid_desc) ||
+		valid_desc.width != desc.width || valid_desc.height != desc.height ||
+		valid_desc.channels != px_channels || valid_desc.colorspace != desc.colorspace ||
+		valid_desc.qoi_compat != desc.qoi_compat || valid_desc.checksum != desc.checksum
+	) {
+		abort();
+	}
+	fuzz_check_decode(encoded, encoded_size, &desc, pixels);
+
+	// The streaming encoder gives the same bytes as sqoa_encode without effort
+	sqoa_desc stream_desc = desc;
+	stream_desc.effort = 0;
+	void *reference = encoded;
+	int reference_size = encoded_size;
+	if (desc.effort != 0) {
+		reference = sqoa_encode(pixels, &stream_desc, &reference_size);
+	}
+	fuzz_buffer stream = {0};
+	sqoa_encoder *encoder = sqoa_encoder_create(&stream_desc, fuzz_write, &stream);
+	if (encoder == NULL || reference == NULL) {
+		abort();
+	}
+	for (int y = 0; y < (int)desc.height; y += rows_per_call) {
+		int rows = (int)desc.height - y < rows_per_call ? (int)desc.height - y : rows_per_call;
+		if (!sqoa_encoder_rows(encoder, pixels + y * stride, rows)) {
+			abort();
+		}
+	}
+	if (
+		sqoa_encoder_finish(encoder) != reference_size ||
+		stream.size != reference_size ||
+		memcmp(stream.data, reference, reference_size) != 0
+	) {
+		abort();
+	}
+	if (reference != encoded) {
+		free(reference);
+	}
+	free(stream.data);
+
+	// Transcode between SQOA and QOI, or change the extensions of grey images
+	sqoa_desc options = desc;
+	if (desc.channels >= 3) {
+		options.qoi_compat = !desc.qoi_compat;
+		options.index_cache = options.predictor = options.transform = options.checksum = 0;
+	}
+	else {
+		options.predictor = (desc.predictor + 1) & 3;
+		options.index_cache = !desc.index_cache;
+	}
+	fuzz_buffer transcoded = {0};
+	if (sqoa_transcode(encoded, encoded_size, &options, fuzz_write, &transcoded) != transcoded.size) {
+		abort();
+	}
+	fuzz_check_decode(transcoded.data, transcoded.size, &desc, pixels);
+	free(transcoded.data);
+
+	// Bands, and the same bands after one pixel changed
+	int band_height = rows_per_call;
+	int banded_size, updated_size;
+	void *banded = sqoa_band_encode(pixels, &desc, band_height, &banded_size);
+	void *updated = banded ? sqoa_band_update(banded, banded_size, changed, &desc, &rect, 1, &updated_size) : NULL;
+	if (banded == NULL || updated == NULL) {
+		abort();
+	}
+	sqoa_desc band_desc;
+	unsigned char *band_pixels = sqoa_band_decode(banded, banded_size, &band_desc, 0);
+	unsigned char *updated_pixels = sqoa_band_decode(updated, updated_size, &band_desc, 0);
+	if (
+		band_pixels == NULL || updated_pixels == NULL ||
+		memcmp(band_pixels, pixels, px_len) != 0 ||
+		memcmp(updated_pixels, changed, px_len) != 0
+	) {
+		abort();
+	}
+	free(banded);
+	free(updated);
+	free(band_pixels);
+	free(updated_pixels);
+
+	// A two frame animation, decoded directly and played in place
+	const void *frames[2] = {pixels, changed};
+	int anim_size;
+	void *anim = sqoa_anim_encode(frames, 2, &desc, data[2] & 1, &anim_size);
+	if (anim == NULL) {
+		abort();
+	}
+	sqoa_desc anim_desc;
+	unsigned char *frame = sqoa_anim_decode(anim, anim_size, &anim_desc, 1, 0);
+	unsigned char *played = malloc(px_len);
+	if (
+		frame == NULL || played == NULL ||
+		memcmp(frame, changed, px_len) != 0 ||
+		!sqoa_anim_next(anim, anim_size, 0, played, 0) ||
+		memcmp(played, pixels, px_len) != 0 ||
+		!sqoa_anim_next(anim, anim_size, 1, played, 0) ||
+		memcmp(played, changed, px_len) != 0
+	) {
+		abort();
+	}
+	free(anim);
+	free(frame);
+	free(played);
+
+	free(encoded);
+	free(pixels);
+	free(changed);
+	return 0;
+}
+
+#elif defined(SQOAFUZZ_QOI)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size < 2 || size > INT_MAX) {
+		return 0;
+	}
+
+	if ((data[0] & 1) == 0) {
+		// Decode the same bytes with both, channels 0, 3 or 4
+		int channels = (data[0] >> 1) % 3;
+		if (channels) {
+			channels += 2;
+		}
+		qoi_desc ref_desc;
+		sqoa_desc desc;
+		unsigned char *ref = qoi_decode(data + 1, (int)(size - 1), &ref_desc, channels);
+		unsigned char *decoded = sqoa_decode(data + 1, (int)(size - 1), &desc, channels);
+
+		// The decoders differ on the chunks cut short by the end of the data,
+		// which the reference decodes from the end marker: only compare the
+		// pixels of valid QOI images
+		int valid = size >= 5 && memcmp(data + 1, "qoif", 4) == 0 &&
+			sqoa_validate(data + 1, (int)(size - 1), &desc);
+		if (valid && (ref == NULL || decoded == NULL)) {
+			abort();
+		}
+		if (ref != NULL && decoded != NULL) {
+			if (channels == 0) {
+				channels = ref_desc.channels;
+			}
+			if (
+				desc.width != ref_desc.width || desc.height != ref_desc.height ||
+				desc.channels != ref_desc.channels || desc.colorspace != ref_desc.colorspace ||
+				(valid && memcmp(ref, decoded, (size_t)desc.width * desc.height * channels) != 0)
+			) {
+				abort();
+			}
+		}
+		free(ref);
+		free(decoded);
+		return 0;
+	}
+
+	// Encode the same pixels with both
+	int channels = 3 + ((data[0] >> 1) & 1);
+	int width = data[1] + 1;
+	int height = (int)(size - 2) / (width * channels);
+	if (height == 0) {
+		return 0;
+	}
+	size_t px_len = (size_t)width * height * channels;
+
+	int ref_size, encoded_size;
+	void *ref = qoi_encode(data + 2, &(qoi_desc){
+		.width = width,
+		.height = height,
+		.channels = channels,
+		.colorspace = QOI_SRGB
+	}, &ref_size);
+	void *encoded = sqoa_encode(data + 2, &(sqoa_desc){
+		.width = width,
+		.height = height,
+		.channels = channels,
+		.colorspace = SQOA_SRGB,
+		.qoi_compat = 1
+	}, &encoded_size);
+	if (ref == NULL || encoded == NULL) {
+		abort();
+	}
+
+	qoi_desc ref_desc;
 	sqoa_desc desc;
-	void* decoded = sqoa_decode((void*)(data + 4), (int)(size - 4), &desc, *((int *)data));
+	unsigned char *ref_decoded = qoi_decode(encoded, encoded_size, &ref_desc, channels);
+	unsigned char *decoded = sqoa_decode(ref, ref_size, &desc, channels);
+	if (
+		ref_decoded == NULL || decoded == NULL ||
+		memcmp(ref_decoded, data + 2, px_len) != 0 ||
+		memcmp(decoded, data + 2, px_len) != 0
+	) {
+		abort();
+	}
+	free(ref);
+	free(encoded);
+	free(ref_decoded);
+	free(decoded);
+	return 0;
+}
+
+#else
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size < 1 || size > INT_MAX) {
+		return 0;
+	}
+
+	// -1 to 6 channels, the invalid ones included
+	int channels = (data[0] & 7) - 1;
+	int scale = 1 << ((data[0] >> 3) & 3);
+	int to_qoi = (data[0] >> 5) & 1;
+	int frame = data[0] >> 6;
+	const uint8_t *image = data + 1;
+	int image_size = (int)(size - 1);
+
+	sqoa_desc desc;
+	unsigned char *decoded = sqoa_decode(image, image_size, &desc, channels);
+	sqoa_set_simd_level(SQOA_SIMD_SCALAR);
+	unsigned char *scalar = sqoa_decode(image, image_size, &desc, channels);
+	sqoa_set_simd_level(SQOA_SIMD_AUTO);
+	if ((decoded == NULL) != (scalar == NULL)) {
+		abort();
+	}
+
+	sqoa_desc valid_desc;
+	int valid = sqoa_validate(image, image_size, &valid_desc);
+	if (valid && channels >= 0 && channels <= 4 && decoded == NULL) {
+		abort();
+	}
+
+	// The chunks of a valid image cover all its pixels
+	unsigned int counts[SQOA_HIST_COUNT];
+	if (sqoa_histogram(image, image_size, &valid_desc, counts) != valid) {
+		abort();
+	}
+	if (valid) {
+		unsigned long long pixels = 0;
+		for (int k = SQOA_HIST_RGB; k <= SQOA_HIST_DIFF; k++) {
+			pixels += counts[k];
+		}
+		if (pixels > (unsigned long long)valid_desc.width * valid_desc.height || pixels == 0) {
+			abort();
+		}
+	}
+
+	// A valid image decodes the same as its bytes arrive in pieces, and an
+	// image that decodes so is complete
+	unsigned char *streamed = fuzz_stream_decode(image, image_size, channels, data[0]);
+	if ((valid && channels >= 0 && channels <= 4 && streamed == NULL) || (streamed != NULL && decoded == NULL)) {
+		abort();
+	}
+	if (streamed != NULL) {
+		int out_channels = channels ? channels : fuzz_channels(&desc);
+		if (memcmp(streamed, decoded, (size_t)desc.width * desc.height * out_channels) != 0) {
+			abort();
+		}
+		free(streamed);
+	}
+
 	if (decoded != NULL) {
-		free(decoded);
+		int out_channels = channels ? channels : fuzz_channels(&desc);
+		size_t len = (size_t)desc.width * desc.height * out_channels;
+		if (memcmp(decoded, scalar, len) != 0) {
+			abort();
+		}
+
+		// Decoding into a buffer of the exact size gives the same pixels
+		unsigned char *into = malloc(len);
+		if (
+			into == NULL ||
+			sqoa_decode_into(image, image_size, &desc, channels, into, (int)len - 1) ||
+			!sqoa_decode_into(image, image_size, &desc, channels, into, (int)len) ||
+			memcmp(into, decoded, len) != 0
+		) {
+			abort();
+		}
+		free(into);
+
+		unsigned char *scaled = sqoa_decode_scaled(image, image_size, &desc, channels, scale);
+		if (scaled == NULL) {
+			abort();
+		}
+		fuzz_check_scaled(decoded, scaled, desc.width, desc.height, out_channels, scale);
+		free(scaled);
+
+		// The transcoded image decodes to the same pixels, in the channels of
+		// the header: the alpha of an image without alpha is not transcoded
+		fuzz_buffer transcoded = {0};
+		sqoa_desc options = {
+			.qoi_compat = to_qoi && desc.channels >= 3
+		};
+		if (sqoa_transcode(image, image_size, &options, fuzz_write, &transcoded) != transcoded.size) {
+			abort();
+		}
+		sqoa_desc redecoded_desc;
+		unsigned char *source = sqoa_decode(image, image_size, &desc, 0);
+		unsigned char *redecoded = sqoa_decode(transcoded.data, transcoded.size, &redecoded_desc, 0);
+		if (
+			source == NULL || redecoded == NULL ||
+			memcmp(redecoded, source, (size_t)desc.width * desc.height * fuzz_channels(&desc)) != 0
+		) {
+			abort();
+		}
+		free(source);
+		free(redecoded);
+		free(transcoded.data);
+	}
+	free(decoded);
+	free(scalar);
+
+	void *anim_frame = sqoa_anim_decode(image, image_size, &desc, frame, channels);
+	if (anim_frame != NULL) {
+		// Playing the frames in place gives the same pixels, unless a frame
+		// before the last keyframe is invalid
+		int out_channels = channels ? channels : fuzz_channels(&desc);
+		size_t len = (size_t)desc.width * desc.height * out_channels;
+		unsigned char *played = malloc(len);
+		if (played != NULL) {
+			int ok = 1;
+			for (int i = 0; ok && i <= frame; i++) {
+				ok = sqoa_anim_next(image, image_size, i, played, channels);
+			}
+			if (ok && memcmp(played, anim_frame, len) != 0) {
+				abort();
+			}
+			free(played);
+		}
+		free(anim_frame);
 	}
+
+	void *band_pixels = sqoa_band_decode(image, image_size, &desc, channels);
+	if (band_pixels != NULL) {
+		// The last bands, after the header written by sqoa_band_subset, decode
+		// to the same rows
+		int bands = sqoa_band_index(image, image_size, &desc, NULL, 0);
+		int first = frame % bands, count = bands - first;
+		sqoa_band *band = malloc(bands * sizeof(sqoa_band));
+		unsigned char *subset = NULL;
+		size_t subset_size = SQOA_BAND_INDEX_SIZE(count);
+		if (band != NULL) {
+			if (sqoa_band_index(image, image_size, &desc, band, bands) != bands) {
+				abort();
+			}
+			// Bands may share their bytes, each is copied
+			for (int b = first; b < bands; b++) {
+				subset_size += band[b].size;
+			}
+			if (subset_size <= INT_MAX) {
+				subset = malloc(subset_size);
+			}
+		}
+		if (subset != NULL) {
+			int p = sqoa_band_subset(image, image_size, first, count, subset, SQOA_BAND_INDEX_SIZE(count));
+			if (p != SQOA_BAND_INDEX_SIZE(count)) {
+				abort();
+			}
+			for (int b = first; b < bands; b++) {
+				memcpy(subset + p, image + band[b].offset, band[b].size);
+				p += band[b].size;
+			}
+			sqoa_desc subset_desc;
+			unsigned char *subset_pixels = sqoa_band_decode(subset, p, &subset_desc, channels);
+			size_t row = (size_t)desc.width * (channels ? channels : fuzz_channels(&desc));
+			if (
+				subset_pixels == NULL || subset_desc.height != desc.height - band[first].y ||
+				memcmp(subset_pixels, (unsigned char *)band_pixels + band[first].y * row, subset_desc.height * row) != 0
+			) {
+				abort();
+			}
+			free(subset_pixels);
+		}
+		free(subset);
+		free(band);
+	}
+	free(band_pixels);
 	return 0;
 }
+
+#endif
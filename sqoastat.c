@@ -0,0 +1,437 @@
+/*
+
+Copyright (c) 2021, Dominic Szablewski - https://phoboslab.org
+SPDX-License-Identifier: MIT
+
+
+Compression statistics for a corpus of png, sqoa and qoi images
+
+Requires "stb_image.h" (https://github.com/nothings/stb/blob/master/stb_image.h)
+Compile with:
+    gcc sqoastat.c -std=gnu99 -O3 -pthread -o sqoastat
+
+Walks a directory tree and encodes every image in QOI mode and in SQOA mode at
+each chosen effort, on several threads. Prints one CSV line per image and mode
+to stdout: the encoded size, its ratio to the raw pixels, the encode and decode
+times and how many chunks of each kind the image has. The lines of different
+images come in the order the threads finish them.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_NO_LINEAR
+#include "stb_image.h"
+
+#define SQOA_IMPLEMENTATION
+#include "seqoia.h"
+
+#define STR_ENDS_WITH(S, E) (strlen(S) >= sizeof(E)-1 && strcmp(S + strlen(S) - (sizeof(E)-1), E) == 0)
+
+static int opt_threads = 0;
+static int opt_runs = 1;
+static int opt_noqoi = 0;
+static int opt_norecurse = 0;
+static int opt_efforts[3] = {1, 0, 0};
+static sqoa_desc opt_ext_desc = {0};
+
+static const char *hist_names[SQOA_HIST_COUNT] = {
+    "rgb", "rgba", "luma", "run", "bigrun", "index", "diff", "alpha", "ref"
+};
+
+static double now_ms(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1e3 + spec.tv_nsec * 1e-6;
+}
+
+// The CSV lines and the errors of the threads, one at a time
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static int failures = 0;
+
+static void fail(const char *message, const char *path) {
+    pthread_mutex_lock(&out_lock);
+    fprintf(stderr, "%s %s\n", message, path);
+    failures++;
+    pthread_mutex_unlock(&out_lock);
+}
+
+
+// -----------------------------------------------------------------------------
+// The paths found by the directory walk, waiting for a thread
+
+#define QUEUE_SIZE 256
+
+typedef struct {
+    char *paths[QUEUE_SIZE];
+    int head;
+    int count;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} path_queue;
+
+static void queue_push(path_queue *q, char *path) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == QUEUE_SIZE) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->paths[(q->head + q->count++) % QUEUE_SIZE] = path;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Returns NULL once the walk is done and every path was taken
+static char *queue_pop(path_queue *q) {
+    char *path = NULL;
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->done) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    if (q->count > 0) {
+        path = q->paths[q->head];
+        q->head = (q->head + 1) % QUEUE_SIZE;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return path;
+}
+
+static void queue_finish(path_queue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->done = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void walk_directory(const char *path, path_queue *q) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fail("Couldn't open directory", path);
+        return;
+    }
+
+    struct dirent *file;
+    while ((file = readdir(dir)) != NULL) {
+        if (strcmp(file->d_name, ".") == 0 || strcmp(file->d_name, "..") == 0) {
+            continue;
+        }
+
+        char *file_path = malloc(strlen(path) + strlen(file->d_name) + 2);
+        if (!file_path) {
+            continue;
+        }
+        sprintf(file_path, "%s/%s", path, file->d_name);
+
+        int is_dir = file->d_type == DT_DIR;
+        if (file->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = stat(file_path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+
+        if (is_dir) {
+            if (!opt_norecurse) {
+                walk_directory(file_path, q);
+            }
+            free(file_path);
+        }
+        else if (
+            STR_ENDS_WITH(file_path, ".png") ||
+            STR_ENDS_WITH(file_path, ".sqoa") ||
+            STR_ENDS_WITH(file_path, ".qoi")
+        ) {
+            queue_push(q, file_path);
+        }
+        else {
+            free(file_path);
+        }
+    }
+    closedir(dir);
+}
+
+
+// -----------------------------------------------------------------------------
+// Statistics of one image
+
+// Load the pixels of an image with the channels of the file, 1 to 4
+static void *load_image(const char *path, int *w, int *h, int *channels) {
+    if (STR_ENDS_WITH(path, ".png")) {
+        if (!stbi_info(path, w, h, channels)) {
+            return NULL;
+        }
+        return stbi_load(path, w, h, NULL, *channels);
+    }
+
+    sqoa_desc desc;
+    void *pixels = sqoa_read(path, &desc, 0);
+    if (pixels) {
+        *w = desc.width;
+        *h = desc.height;
+        *channels = (desc.channels < 3 ? 1 : 3) + ((desc.channels & 1) == 0);
+    }
+    return pixels;
+}
+
+// QOI has no grey images: copy the grey to r, g and b
+static unsigned char *grey_to_rgb(const unsigned char *pixels, int count, int channels) {
+    unsigned char *rgb = malloc((size_t)count * (channels + 2));
+    if (!rgb) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        unsigned char *dst = rgb + i * (channels + 2);
+        dst[0] = dst[1] = dst[2] = pixels[i * channels];
+        if (channels == 2) {
+            dst[3] = pixels[i * channels + 1];
+        }
+    }
+    return rgb;
+}
+
+// Encode and decode pixels opt_runs times with desc and append a CSV line to
+// line, path being quoted already. Returns 0 if the image doesn't decode to
+// the same pixels.
+static int stat_mode(
+    const char *path, const char *mode, const void *pixels,
+    const sqoa_desc *desc, char *line, size_t line_size
+) {
+    int size = 0;
+    void *encoded = NULL;
+    void *decoded = NULL;
+    sqoa_desc decoded_desc;
+    double encode_ms = 0, decode_ms = 0;
+    size_t raw_size = (size_t)desc->width * desc->height * desc->channels;
+
+    for (int i = 0; i < opt_runs; i++) {
+        free(encoded);
+        double start = now_ms();
+        encoded = sqoa_encode(pixels, desc, &size);
+        encode_ms += now_ms() - start;
+        if (!encoded) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < opt_runs; i++) {
+        free(decoded);
+        double start = now_ms();
+        decoded = sqoa_decode(encoded, size, &decoded_desc, desc->channels);
+        decode_ms += now_ms() - start;
+        if (!decoded) {
+            free(encoded);
+            return 0;
+        }
+    }
+
+    unsigned int counts[SQOA_HIST_COUNT];
+    int ok =
+        memcmp(decoded, pixels, raw_size) == 0 &&
+        sqoa_histogram(encoded, size, &decoded_desc, counts);
+    free(decoded);
+    free(encoded);
+    if (!ok) {
+        return 0;
+    }
+
+    size_t len = strlen(line);
+    len += snprintf(line + len, line_size - len, "%s,%u,%u,%d,%s,%d,%.4f,%.3f,%.3f",
+        path, desc->width, desc->height, desc->channels, mode, size,
+        (double)size / raw_size, encode_ms / opt_runs, decode_ms / opt_runs
+    );
+    for (int k = 0; k < SQOA_HIST_COUNT && len < line_size; k++) {
+        len += snprintf(line + len, line_size - len, ",%u", counts[k]);
+    }
+    if (len < line_size) {
+        snprintf(line + len, line_size - len, "\n");
+    }
+    return 1;
+}
+
+static void stat_image(const char *path) {
+    int w, h, channels;
+    void *pixels = load_image(path, &w, &h, &channels);
+    if (!pixels) {
+        fail("Couldn't load/decode", path);
+        return;
+    }
+
+    // The lines of an image are printed together. The path is quoted for
+    // CSV, with its quotes doubled.
+    size_t line_size = 4 * (2 * strlen(path) + 256);
+    char *line = malloc(line_size);
+    char *quoted = malloc(2 * strlen(path) + 3);
+    if (!line || !quoted) {
+        free(line);
+        free(quoted);
+        free(pixels);
+        fail("Couldn't allocate for", path);
+        return;
+    }
+    line[0] = '\0';
+
+    char *q = quoted;
+    *q++ = '"';
+    for (const char *c = path; *c; c++) {
+        if (*c == '"') {
+            *q++ = '"';
+        }
+        *q++ = *c;
+    }
+    *q++ = '"';
+    *q = '\0';
+
+    sqoa_desc desc = opt_ext_desc;
+    desc.width = w;
+    desc.height = h;
+    desc.channels = channels;
+    desc.colorspace = SQOA_SRGB;
+
+    int ok = 1;
+    for (int effort = 0; ok && effort <= 2; effort++) {
+        if (opt_efforts[effort]) {
+            static const char *names[] = {"sqoa", "sqoa/e1", "sqoa/e2"};
+            desc.effort = effort;
+            ok = stat_mode(quoted, names[effort], pixels, &desc, line, line_size);
+        }
+    }
+
+    if (ok && !opt_noqoi) {
+        sqoa_desc qoi_desc = {
+            .width = w,
+            .height = h,
+            .channels = channels < 3 ? channels + 2 : channels,
+            .colorspace = SQOA_SRGB,
+            .qoi_compat = 1
+        };
+        void *rgb = channels < 3 ? grey_to_rgb(pixels, w * h, channels) : NULL;
+        ok = (channels >= 3 || rgb) &&
+            stat_mode(quoted, "qoi", rgb ? rgb : pixels, &qoi_desc, line, line_size);
+        free(rgb);
+    }
+
+    if (ok) {
+        pthread_mutex_lock(&out_lock);
+        fputs(line, stdout);
+        pthread_mutex_unlock(&out_lock);
+    }
+    else {
+        fail("Couldn't encode/verify", path);
+    }
+    free(quoted);
+    free(line);
+    free(pixels);
+}
+
+static void *worker(void *arg) {
+    path_queue *q = (path_queue *)arg;
+    char *path;
+    while ((path = queue_pop(q)) != NULL) {
+        stat_image(path);
+        free(path);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: sqoastat <directory> [options]\n");
+        printf("Options:\n");
+        printf("    --threads=N .. number of threads, the number of CPUs by default\n");
+        printf("    --runs=N ..... average the times of N encodes and decodes\n");
+        printf("    --effort=L ... SQOA encoder efforts to compare, L is a list of\n");
+        printf("                   0, 1 and 2 (default 0)\n");
+        printf("    --noqoi ...... don't encode in QOI mode\n");
+        printf("    --norecurse .. don't descend into directories\n");
+        printf("SQOA extensions, used at every effort:\n");
+        printf("    --index ...... colour index cache\n");
+        printf("    --predict=X .. predict from the row above, X is up, avg or paeth\n");
+        printf("    --ycocg ...... YCoCg-R colour transform\n");
+        printf("    --checksum ... CRC-32C trailer\n");
+        printf("Examples\n");
+        printf("    sqoastat images/ > stats.csv\n");
+        printf("    sqoastat images/ --effort=0,1,2 --noqoi --threads=8\n");
+        exit(1);
+    }
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) { opt_threads = atoi(argv[i] + 10); }
+        else if (strncmp(argv[i], "--runs=", 7) == 0) { opt_runs = atoi(argv[i] + 7); }
+        else if (strncmp(argv[i], "--effort=", 9) == 0) {
+            memset(opt_efforts, 0, sizeof(opt_efforts));
+            for (const char *c = argv[i] + 9; *c; c++) {
+                if (*c >= '0' && *c <= '2') {
+                    opt_efforts[*c - '0'] = 1;
+                }
+                else if (*c != ',') {
+                    fprintf(stderr, "Invalid effort list %s\n", argv[i] + 9);
+                    exit(1);
+                }
+            }
+        }
+        else if (strcmp(argv[i], "--noqoi") == 0) { opt_noqoi = 1; }
+        else if (strcmp(argv[i], "--norecurse") == 0) { opt_norecurse = 1; }
+        else if (strcmp(argv[i], "--index") == 0) { opt_ext_desc.index_cache = 1; }
+        else if (strcmp(argv[i], "--predict=up") == 0) { opt_ext_desc.predictor = SQOA_PRED_UP; }
+        else if (strcmp(argv[i], "--predict=avg") == 0) { opt_ext_desc.predictor = SQOA_PRED_AVG; }
+        else if (strcmp(argv[i], "--predict=paeth") == 0) { opt_ext_desc.predictor = SQOA_PRED_PAETH; }
+        else if (strcmp(argv[i], "--ycocg") == 0) { opt_ext_desc.transform = SQOA_TRANSFORM_YCOCG_R; }
+        else if (strcmp(argv[i], "--checksum") == 0) { opt_ext_desc.checksum = 1; }
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (opt_threads <= 0) {
+        opt_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (opt_threads <= 0) {
+            opt_threads = 1;
+        }
+    }
+    if (opt_runs <= 0) {
+        fprintf(stderr, "Invalid number of runs %d\n", opt_runs);
+        exit(1);
+    }
+
+    printf("path,width,height,channels,mode,size,ratio,encode_ms,decode_ms");
+    for (int k = 0; k < SQOA_HIST_COUNT; k++) {
+        printf(",%s", hist_names[k]);
+    }
+    printf("\n");
+
+    path_queue q = {0};
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.not_empty, NULL);
+    pthread_cond_init(&q.not_full, NULL);
+
+    pthread_t *threads = malloc(opt_threads * sizeof(pthread_t));
+    int started = 0;
+    while (threads && started < opt_threads && pthread_create(&threads[started], NULL, worker, &q) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        fprintf(stderr, "Couldn't start the threads\n");
+        exit(1);
+    }
+
+    walk_directory(argv[1], &q);
+    queue_finish(&q);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    pthread_mutex_destroy(&q.lock);
+    pthread_cond_destroy(&q.not_empty);
+    pthread_cond_destroy(&q.not_full);
+    return failures ? 1 : 0;
+}